@@ -0,0 +1,458 @@
+/* droceRoG - SGF parser benchmark
+ *
+ * Parses SGF files, the files of corpus directories or, without
+ * arguments, a generated game (see sgfgen.c) repeatedly and prints the
+ * parser throughput in MB/s and nodes/s, the peak resident set size of
+ * the process and the number of allocations per parse. Every game of a
+ * collection is parsed, into an arena as the viewer does; with -f each
+ * file is read with readsgffile() instead, which reads the first game
+ * onto the heap. -p parses the variations of every game with the given
+ * number of threads, see sgf_read_parallel(). -j prints one JSON object
+ * per input, for comparing parser changes with scripts.
+ *
+ * Usage: sgfbench [-i iterations] [-f] [-p threads] [-j] [generator options]
+ *                 [file.sgf | directory ...]
+ *
+ * Compare with sgfbench_scalar, which is built from the same sources
+ * scanning one byte at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "sgftree.h"
+#include "sgfgen.h"
+
+/******************************************************************************/
+
+#define DEFAULT_ITERATIONS 20
+
+typedef struct {
+    size_t bytes;       /* per iteration */
+    int iterations;
+    double elapsed;     /* seconds spent parsing */
+    unsigned long nodes; /* per iteration */
+    long allocs;        /* per iteration, -1 if not counted */
+} BenchResult;
+
+/******************************************************************************/
+
+static int iterations = DEFAULT_ITERATIONS;
+static int bReadFile = 0; /* time readsgffile() */
+static int bJson = 0;
+static int threads = 0; /* parse in parallel if > 0 */
+
+/******************************************************************************/
+
+#ifdef SGFBENCH_COUNT_ALLOCS
+/* the program is linked with --wrap for these, see CMakeLists.txt */
+static unsigned long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) { allocations++; return __real_malloc(size); }
+void *__wrap_calloc(size_t num, size_t size) { allocations++; return __real_calloc(num, size); }
+void *__wrap_realloc(void *ptr, size_t size) { allocations++; return __real_realloc(ptr, size); }
+#endif
+
+/******************************************************************************/
+
+double now();
+long peak_rss();
+long count_allocations();
+unsigned long count_nodes(SGFNode *root);
+int parse_games(char *buffer, size_t size, SGFArena *arena, unsigned long *nodes);
+int bench_buffer(const char *name, const char *input, size_t size, BenchResult *result);
+int bench_readfile(const char *name, BenchResult *result);
+int bench_file(const char *name, BenchResult *result);
+int bench_directory(const char *dirname, BenchResult *result);
+int bench_generated(const SGFGenOptions *opts, BenchResult *result);
+int is_bench_filename(const char *name);
+int compare_names(const void *a, const void *b);
+void print_result(const char *name, const BenchResult *result);
+
+/******************************************************************************/
+
+double now()
+{/*{{{*/
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}/*}}}*/
+
+/* in KB */
+long peak_rss()
+{/*{{{*/
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;
+}/*}}}*/
+
+long count_allocations()
+{/*{{{*/
+#ifdef SGFBENCH_COUNT_ALLOCS
+    return allocations;
+#else
+    return -1;
+#endif
+}/*}}}*/
+
+/* all nodes of the tree, in pre-order without recursion */
+unsigned long count_nodes(SGFNode *root)
+{/*{{{*/
+    unsigned long num = 0;
+    SGFNode *node = root;
+
+    while (node) {
+        num++;
+        if (node->child) {
+            node = node->child;
+            continue;
+        }
+        while (node != root && !node->next)
+            node = node->parent;
+        node = node == root ? NULL : node->next;
+    }
+    return num;
+}/*}}}*/
+
+/* Parse every game in buffer into the arena, and count their nodes
+ * unless nodes is NULL. Returns 0 on a parse error.
+ */
+int parse_games(char *buffer, size_t size, SGFArena *arena, unsigned long *nodes)
+{/*{{{*/
+    SGFGame *games;
+    int num_games, i;
+
+    if (nodes)
+        *nodes = 0;
+    num_games = sgf_index_games(buffer, size, &games);
+    for (i = 0; i < num_games; i++) {
+        SGFParser parser;
+        SGFNode *root;
+
+        if (threads > 0) {
+            root = sgf_read_parallel(buffer + games[i].offset, games[i].length,
+                                     arena, threads);
+        } else {
+            sgfparser_init(&parser, buffer + games[i].offset, games[i].length, arena, 0);
+            root = sgfparser_read(&parser);
+        }
+        if (!root) {
+            fprintf(stderr, "parse error in game %d\n", i + 1);
+            free(games);
+            return 0;
+        }
+        if (nodes)
+            *nodes += count_nodes(root);
+    }
+    free(games);
+    return num_games > 0;
+}/*}}}*/
+
+/* Parse input iterations times, each time from a fresh copy since the
+ * parser works in place, after a first parse which counts the nodes.
+ * Only the parsing is timed.
+ */
+int bench_buffer(const char *name, const char *input, size_t size, BenchResult *result)
+{/*{{{*/
+    char *work;
+    long allocs = 0;
+    double start;
+    int i;
+
+    work = malloc(size);
+    if (!work)
+        return 1;
+
+    result->bytes = size;
+    result->iterations = iterations;
+    result->elapsed = 0.0;
+    for (i = -1; i < iterations; i++) {
+        SGFArena arena;
+        int ok;
+
+        memcpy(work, input, size);
+        sgfArenaInit(&arena);
+
+        if (i < 0) {
+            ok = parse_games(work, size, &arena, &result->nodes);
+        } else {
+            allocs -= count_allocations();
+            start = now();
+            ok = parse_games(work, size, &arena, NULL);
+            result->elapsed += now() - start;
+            allocs += count_allocations();
+        }
+
+        sgfArenaFree(&arena);
+        if (!ok) {
+            fprintf(stderr, "%s: cannot parse\n", name);
+            free(work);
+            return 1;
+        }
+    }
+    result->allocs = count_allocations() < 0 ? -1 : allocs / iterations;
+
+    free(work);
+    return 0;
+}/*}}}*/
+
+/* Read the file with readsgffile() iterations times; the tree is freed
+ * outside the timing.
+ */
+int bench_readfile(const char *name, BenchResult *result)
+{/*{{{*/
+    struct stat st;
+    long allocs = 0;
+    double start;
+    int i;
+
+    if (stat(name, &st) != 0) {
+        fprintf(stderr, "%s: cannot read file\n", name);
+        return 1;
+    }
+
+    result->bytes = st.st_size;
+    result->iterations = iterations;
+    result->elapsed = 0.0;
+    for (i = 0; i < iterations; i++) {
+        SGFNode *root;
+
+        allocs -= count_allocations();
+        start = now();
+        root = readsgffile(name);
+        result->elapsed += now() - start;
+        allocs += count_allocations();
+
+        if (!root) {
+            fprintf(stderr, "%s: cannot parse\n", name);
+            return 1;
+        }
+        result->nodes = count_nodes(root);
+        sgfFreeNode(root);
+    }
+    result->allocs = count_allocations() < 0 ? -1 : allocs / iterations;
+
+    return 0;
+}/*}}}*/
+
+int bench_file(const char *name, BenchResult *result)
+{/*{{{*/
+    size_t size;
+    int mapped;
+    char *buffer;
+    int ret;
+
+    if (bReadFile)
+        return bench_readfile(name, result);
+
+    buffer = sgf_loadfile(name, &size, &mapped);
+    if (!buffer) {
+        fprintf(stderr, "%s: cannot read file\n", name);
+        return 1;
+    }
+    ret = bench_buffer(name, buffer, size, result);
+    sgf_unloadfile(buffer, size, mapped);
+    return ret;
+}/*}}}*/
+
+/* SGF files, and compressed ones when they are read with readsgffile() */
+int is_bench_filename(const char *name)
+{/*{{{*/
+    size_t len = strlen(name);
+
+    if (len >= 4 && !strcmp(name + len - 4, ".sgf"))
+        return 1;
+    return bReadFile && sgf_is_compressed(name);
+}/*}}}*/
+
+int compare_names(const void *a, const void *b)
+{/*{{{*/
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}/*}}}*/
+
+/* Benchmark the SGF files of a directory in the order of their names,
+ * and sum up the results.
+ */
+int bench_directory(const char *dirname, BenchResult *result)
+{/*{{{*/
+    DIR *dir;
+    struct dirent *entry;
+    char **names = NULL;
+    int numNames = 0, i;
+    int ret = 0;
+
+    dir = opendir(dirname);
+    if (!dir) {
+        fprintf(stderr, "%s: cannot read directory\n", dirname);
+        return 1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char **newNames;
+
+        if (!is_bench_filename(entry->d_name))
+            continue;
+        newNames = realloc(names, (numNames + 1) * sizeof(char *));
+        if (!newNames)
+            break;
+        names = newNames;
+        names[numNames] = malloc(strlen(dirname) + strlen(entry->d_name) + 2);
+        if (!names[numNames])
+            break;
+        sprintf(names[numNames], "%s/%s", dirname, entry->d_name);
+        numNames++;
+    }
+    closedir(dir);
+    qsort(names, numNames, sizeof(char *), compare_names);
+
+    memset(result, 0, sizeof(*result));
+    result->iterations = iterations;
+    for (i = 0; i < numNames; i++) {
+        BenchResult fileResult;
+
+        if (bench_file(names[i], &fileResult)) {
+            ret = 1;
+        } else {
+            print_result(names[i], &fileResult);
+            result->bytes += fileResult.bytes;
+            result->elapsed += fileResult.elapsed;
+            result->nodes += fileResult.nodes;
+            result->allocs = fileResult.allocs < 0 ? -1 : result->allocs + fileResult.allocs;
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}/*}}}*/
+
+/* readsgffile() needs a file, the generated text is written to a
+ * temporary one */
+int bench_generated(const SGFGenOptions *opts, BenchResult *result)
+{/*{{{*/
+    char tmpname[] = "/tmp/sgfbenchXXXXXX";
+    size_t size;
+    char *text = sgfgen_generate(opts, &size);
+    int ret, fd;
+
+    if (!text)
+        return 1;
+    if (!bReadFile) {
+        ret = bench_buffer("<generated>", text, size, result);
+        free(text);
+        return ret;
+    }
+
+    fd = mkstemp(tmpname);
+    if (fd < 0) {
+        free(text);
+        return 1;
+    }
+    ret = write(fd, text, size) != (ssize_t) size;
+    close(fd);
+    free(text);
+    if (!ret)
+        ret = bench_readfile(tmpname, result);
+    unlink(tmpname);
+    return ret;
+}/*}}}*/
+
+void print_result(const char *name, const BenchResult *result)
+{/*{{{*/
+    double mbs = result->bytes * (double) result->iterations / result->elapsed
+                 / (1024.0 * 1024.0);
+    double nps = result->nodes * (double) result->iterations / result->elapsed;
+
+    if (bJson) {
+        const char *p;
+
+        printf("{\"name\": \"");
+        for (p = name; *p; p++)
+            printf(*p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+        printf("\", \"bytes\": %lu, \"iterations\": %d, \"seconds\": %.6f, "
+               "\"mb_per_s\": %.2f, \"nodes\": %lu, \"nodes_per_s\": %.0f, "
+               "\"peak_rss_kb\": %ld, \"allocs\": ",
+               (unsigned long) result->bytes, result->iterations, result->elapsed,
+               mbs, result->nodes, nps, peak_rss());
+        if (result->allocs < 0)
+            printf("null}\n");
+        else
+            printf("%ld}\n", result->allocs);
+    } else {
+        printf("%-32s %10lu bytes %10.1f MB/s %12.0f nodes/s %8ld KB RSS",
+               name, (unsigned long) result->bytes, mbs, nps, peak_rss());
+        if (result->allocs >= 0)
+            printf(" %8ld allocs", result->allocs);
+        printf("\n");
+    }
+    fflush(stdout);
+}/*}}}*/
+
+int main(int argc, char *argv[])
+{
+    SGFGenOptions opts;
+    BenchResult result;
+    int ret = 0;
+    int opt, i;
+
+    sgfgen_defaults(&opts);
+    while ((opt = getopt(argc, argv, "i:fjp:" SGFGEN_OPTIONS)) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atoi(optarg);
+                if (iterations < 1)
+                    iterations = 1;
+                break;
+            case 'f':
+                bReadFile = 1;
+                break;
+            case 'j':
+                bJson = 1;
+                break;
+            case 'p':
+                threads = atoi(optarg);
+                break;
+            default:
+                if (!sgfgen_option(&opts, opt, optarg)) {
+                    fprintf(stderr, "Usage: sgfbench [-i iterations] [-f] [-p threads] [-j] "
+                            "[generator options] [file.sgf | directory ...]\n"
+                            SGFGEN_USAGE);
+                    return 2;
+                }
+        }
+    }
+
+    if (optind == argc) {
+        ret = bench_generated(&opts, &result);
+        if (!ret)
+            print_result("<generated>", &result);
+        return ret;
+    }
+
+    for (i = optind; i < argc; i++) {
+        struct stat st;
+
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            ret |= bench_directory(argv[i], &result);
+            if (result.bytes > 0)
+                print_result(argv[i], &result);
+        } else if (!bench_file(argv[i], &result)) {
+            print_result(argv[i], &result);
+        } else {
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,215 @@
+/* droceRoG - synthetic SGF generator
+ *
+ * The games consist of random moves. A line of moves branches at its
+ * middle into the given number of variations: the first continues the
+ * line, the others start new lines one level deeper, which branch
+ * again at their middle until the nesting depth is reached. Every node
+ * can carry a comment, written with the escapes of the SGF text, and
+ * range compressed point lists (setup stones on the root, triangle
+ * markup on the moves). The same options and seed always give the same
+ * text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sgfgen.h"
+
+/******************************************************************************/
+
+typedef struct {
+    const SGFGenOptions *opts;
+    char *buffer;
+    size_t len;
+    size_t alloc;
+    unsigned random;
+    int failed;
+} Generator;
+
+/******************************************************************************/
+
+static unsigned gen_random(Generator *gen, unsigned n);
+static void gen_put(Generator *gen, const char *s, size_t n);
+static void gen_puts(Generator *gen, const char *s);
+static void gen_point(Generator *gen);
+static void gen_ranges(Generator *gen, const char *name);
+static void gen_comment(Generator *gen);
+static void gen_line(Generator *gen, int level, int length, int move);
+static int option_value(const char *arg, int min);
+
+/******************************************************************************/
+
+void sgfgen_defaults(SGFGenOptions *opts)
+{/*{{{*/
+    opts->moves = 300;
+    opts->branching = 1;
+    opts->depth = 1;
+    opts->comment = 2000;
+    opts->ranges = 0;
+    opts->games = 1;
+    opts->seed = 1;
+}/*}}}*/
+
+/* the number in arg, at least min */
+static int option_value(const char *arg, int min)
+{/*{{{*/
+    int value = atoi(arg);
+
+    return value > min ? value : min;
+}/*}}}*/
+
+int sgfgen_option(SGFGenOptions *opts, int opt, const char *arg)
+{/*{{{*/
+    switch (opt) {
+        case 'm': opts->moves = option_value(arg, 0); break;
+        case 'b': opts->branching = option_value(arg, 1); break;
+        case 'd': opts->depth = option_value(arg, 0); break;
+        case 'c': opts->comment = option_value(arg, 0); break;
+        case 'r': opts->ranges = option_value(arg, 0); break;
+        case 'g': opts->games = option_value(arg, 1); break;
+        case 's': opts->seed = option_value(arg, 0); break;
+        default:
+            return 0;
+    }
+    return 1;
+}/*}}}*/
+
+/* xorshift, to be independent of the rand() of the C library */
+static unsigned gen_random(Generator *gen, unsigned n)
+{/*{{{*/
+    gen->random ^= gen->random << 13;
+    gen->random ^= gen->random >> 17;
+    gen->random ^= gen->random << 5;
+    return gen->random % n;
+}/*}}}*/
+
+static void gen_put(Generator *gen, const char *s, size_t n)
+{/*{{{*/
+    if (gen->len + n > gen->alloc) {
+        size_t alloc = gen->alloc * 2 > gen->len + n ? gen->alloc * 2 : gen->len + n;
+        char *buffer = realloc(gen->buffer, alloc);
+
+        if (!buffer) {
+            gen->failed = 1;
+            return;
+        }
+        gen->buffer = buffer;
+        gen->alloc = alloc;
+    }
+    memcpy(gen->buffer + gen->len, s, n);
+    gen->len += n;
+}/*}}}*/
+
+static void gen_puts(Generator *gen, const char *s)
+{/*{{{*/
+    gen_put(gen, s, strlen(s));
+}/*}}}*/
+
+static void gen_point(Generator *gen)
+{/*{{{*/
+    char point[2];
+
+    point[0] = 'a' + gen_random(gen, 19);
+    point[1] = 'a' + gen_random(gen, 19);
+    gen_put(gen, point, 2);
+}/*}}}*/
+
+/* name followed by point lists like [cd:fg] */
+static void gen_ranges(Generator *gen, const char *name)
+{/*{{{*/
+    char value[8];
+    int i;
+
+    gen_puts(gen, name);
+    for (i = 0; i < gen->opts->ranges; i++) {
+        int x = gen_random(gen, 16), y = gen_random(gen, 16);
+
+        sprintf(value, "[%c%c:%c%c]", 'a' + x, 'a' + y,
+                'a' + x + 1 + gen_random(gen, 3), 'a' + y + 1 + gen_random(gen, 3));
+        gen_puts(gen, value);
+    }
+}/*}}}*/
+
+static void gen_comment(Generator *gen)
+{/*{{{*/
+    static const char *words[] = {
+        "black", "white", "takes", "the", "corner", "ko", "threat", "[sic\\]",
+        "is", "a", "mistake", "here:", "better", "to", "tenuki", "\\\\",
+        "joseki", "\n", "and", "sente", "gote", "aji", "  ", "shape"
+    };
+    size_t numWords = sizeof(words) / sizeof(words[0]);
+    size_t start = gen->len;
+
+    gen_puts(gen, "C[");
+    while (gen->len - start < (size_t) gen->opts->comment && !gen->failed) {
+        gen_puts(gen, words[gen_random(gen, numWords)]);
+        gen_puts(gen, " ");
+    }
+    gen_puts(gen, "]");
+}/*}}}*/
+
+/* length moves starting with move number move, branching at the middle
+ * while level is below the nesting depth */
+static void gen_line(Generator *gen, int level, int length, int move)
+{/*{{{*/
+    int i, v;
+
+    for (i = 0; i < length; i++) {
+        if (level < gen->opts->depth && gen->opts->branching > 1 && i == length / 2) {
+            for (v = 0; v < gen->opts->branching; v++) {
+                gen_puts(gen, "(");
+                /* the first variation continues the line */
+                gen_line(gen, v ? level + 1 : gen->opts->depth, length - i, move + i);
+                gen_puts(gen, ")");
+            }
+            return;
+        }
+
+        gen_puts(gen, (move + i) % 2 ? ";W[" : ";B[");
+        gen_point(gen);
+        gen_puts(gen, "]");
+        if (gen->opts->ranges > 0)
+            gen_ranges(gen, "TR");
+        if (gen->opts->comment > 0)
+            gen_comment(gen);
+        gen_puts(gen, "\n");
+    }
+}/*}}}*/
+
+char *sgfgen_generate(const SGFGenOptions *opts, size_t *size)
+{/*{{{*/
+    Generator gen;
+    char root[128];
+    int game;
+
+    gen.opts = opts;
+    gen.buffer = NULL;
+    gen.len = 0;
+    gen.alloc = 4096;
+    gen.random = opts->seed ? opts->seed : 1;
+    gen.failed = 0;
+    gen.buffer = malloc(gen.alloc);
+    if (!gen.buffer)
+        return NULL;
+
+    for (game = 0; game < opts->games; game++) {
+        sprintf(root, "(;GM[1]FF[4]SZ[19]KM[6.5]PB[Black %d]PW[White %d]",
+                game + 1, game + 1);
+        gen_puts(&gen, root);
+        if (opts->ranges > 0) {
+            gen_ranges(&gen, "AB");
+            gen_ranges(&gen, "AW");
+        }
+        gen_puts(&gen, "\n");
+        gen_line(&gen, 0, opts->moves, 0);
+        gen_puts(&gen, ")\n");
+    }
+
+    if (gen.failed) {
+        free(gen.buffer);
+        return NULL;
+    }
+    *size = gen.len;
+    return gen.buffer;
+}/*}}}*/
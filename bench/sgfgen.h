@@ -0,0 +1,39 @@
+/* droceRoG - synthetic SGF generator
+ *
+ * Generates games with a controllable shape for the parser benchmark,
+ * see sgfgen.c.
+ */
+
+#ifndef SGFGEN_H
+#define SGFGEN_H
+
+#include <stddef.h>
+
+typedef struct {
+    int moves;          /* moves in the main line of a game */
+    int branching;      /* variations at a branch point */
+    int depth;          /* nesting depth of variations */
+    int comment;        /* bytes of comment on every node */
+    int ranges;         /* range compressed point lists on every node */
+    int games;          /* games in the collection */
+    unsigned seed;
+} SGFGenOptions;
+
+/* option letters understood by sgfgen_option, for getopt */
+#define SGFGEN_OPTIONS "m:b:d:c:r:g:s:"
+#define SGFGEN_USAGE \
+    "  -m moves     moves in the main line (300)\n" \
+    "  -b number    variations at a branch point (1, no branches)\n" \
+    "  -d depth     nesting depth of variations (1)\n" \
+    "  -c bytes     comment size per node (2000)\n" \
+    "  -r number    range compressed point lists per node (0)\n" \
+    "  -g number    games in the collection (1)\n" \
+    "  -s seed      random seed (1)\n"
+
+void sgfgen_defaults(SGFGenOptions *opts);
+/* Returns 1 if opt is a generator option, and stores its value. */
+int sgfgen_option(SGFGenOptions *opts, int opt, const char *arg);
+/* Returns the generated SGF text in an allocated buffer, or NULL. */
+char *sgfgen_generate(const SGFGenOptions *opts, size_t *size);
+
+#endif /* SGFGEN_H */
@@ -0,0 +1,53 @@
+/* droceRoG - synthetic SGF corpus generator
+ *
+ * Writes a generated game or collection, see sgfgen.c, to a file or to
+ * standard output.
+ *
+ * Usage: sgfgen [options] [output.sgf]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sgfgen.h"
+
+int main(int argc, char *argv[])
+{
+    SGFGenOptions opts;
+    FILE *file = stdout;
+    char *text;
+    size_t size;
+    int opt, ok;
+
+    sgfgen_defaults(&opts);
+    while ((opt = getopt(argc, argv, SGFGEN_OPTIONS)) != -1) {
+        if (!sgfgen_option(&opts, opt, optarg)) {
+            fprintf(stderr, "Usage: sgfgen [options] [output.sgf]\n" SGFGEN_USAGE);
+            return 2;
+        }
+    }
+
+    text = sgfgen_generate(&opts, &size);
+    if (!text) {
+        fprintf(stderr, "sgfgen: out of memory\n");
+        return 1;
+    }
+
+    if (optind < argc) {
+        file = fopen(argv[optind], "wb");
+        if (!file) {
+            fprintf(stderr, "%s: cannot write file\n", argv[optind]);
+            free(text);
+            return 1;
+        }
+    }
+    ok = fwrite(text, 1, size, file) == size;
+    if (file != stdout && fclose(file) != 0)
+        ok = 0;
+    if (!ok)
+        fprintf(stderr, "sgfgen: write error\n");
+
+    free(text);
+    return !ok;
+}
@@ -0,0 +1,218 @@
+/* droceRoG - regression check of the variation layout
+ *
+ * Lays out every game of the given files, or of a generated collection
+ * (see sgfgen.c), and compares the draw levels from draw_levels() in
+ * sgfnode.c with the original algorithm below, which scans the whole
+ * prevVar/nextVar chain for every node and thus takes quadratic time on
+ * wide trees. Fails if any node differs. Run by ctest on corpora with
+ * branching and depth, see CMakeLists.txt.
+ *
+ * Usage: sgflayout_check [generator options] [file.sgf ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sgftree.h"
+#include "sgfgen.h"
+
+/******************************************************************************/
+
+void draw_levels_reference(SGFNode *root);
+int collect_nodes(SGFNode *root, SGFNode ***nodes);
+int check_game(const char *text, size_t length, const char *name, int game);
+int check_buffer(const char *buffer, size_t size, const char *name);
+
+/******************************************************************************/
+
+/* The layout before it took linear time. */
+void draw_levels_reference(SGFNode *root)
+{/*{{{*/
+    SGFNode *curMove = NULL;
+    SGFNode *curVar = NULL;
+    SGFNode *i = NULL, *j = NULL;
+    int lvl = 0;
+
+    /* main variation has level of zero */
+    for (curMove=root; curMove; curMove=curMove->child)
+        curMove->draw_lvl = 0;
+
+    /* get last element */
+    for (curMove=root; curMove->child; curMove=curMove->child) {}
+
+    /* go back in time */
+    for (; curMove; curMove=curMove->parent) {
+        curVar = curMove->next;
+        while (curVar) {
+            lvl = 0;
+            for (i=curVar; i; i=i->child) {
+                for (j=i; j; j=j->prevVar) {
+                    if (lvl <= j->draw_lvl+1)
+                        lvl = j->draw_lvl+1;
+                }
+                for (j=i; j; j=j->nextVar) {
+                    if (lvl <= j->draw_lvl+1)
+                        lvl = j->draw_lvl+1;
+                }
+
+                i->draw_lvl = lvl;
+            }
+
+            /* go straight to maximum level without "stairs" */
+            for (i=curVar; i; i=i->child) {
+                /* check if maximum level is reached */
+                if (i->draw_lvl == lvl)
+                    break;
+
+                if (i->draw_lvl != i->parent->draw_lvl + 1)
+                    i->draw_lvl = i->parent->draw_lvl + 1;
+            }
+
+            curVar = curVar->next;
+        }
+    }
+}/*}}}*/
+
+/* The nodes of the tree in pre-order, in an allocated array. Returns their
+ * number. */
+int collect_nodes(SGFNode *root, SGFNode ***nodes)
+{/*{{{*/
+    SGFNode **stack = NULL;
+    SGFNode *node = root;
+    int num = 0, size = 0;
+    int depth = 0, stacksize = 0;
+
+    *nodes = NULL;
+    while (node) {
+        if (num == size) {
+            size = size ? 2 * size : 1024;
+            *nodes = realloc(*nodes, size * sizeof(SGFNode *));
+        }
+        (*nodes)[num++] = node;
+
+        if (node->next) {
+            if (depth == stacksize) {
+                stacksize = stacksize ? 2 * stacksize : 64;
+                stack = realloc(stack, stacksize * sizeof(SGFNode *));
+            }
+            stack[depth++] = node->next;
+        }
+
+        if (node->child)
+            node = node->child;
+        else if (depth > 0)
+            node = stack[--depth];
+        else
+            node = NULL;
+    }
+
+    free(stack);
+    return num;
+}/*}}}*/
+
+/* Check one game, text is the game alone. Returns the number of nodes laid
+ * out differently, -1 if the game cannot be read. */
+int check_game(const char *text, size_t length, const char *name, int game)
+{/*{{{*/
+    SGFNode **nodes;
+    SGFNode *root;
+    char *buffer;
+    int *levels;
+    int k, num, mismatches = 0;
+
+    /* the parser works in place */
+    buffer = malloc(length);
+    memcpy(buffer, text, length);
+    root = readsgfbuffer(buffer, length, NULL, 0);
+    free(buffer);
+    if (!root) {
+        fprintf(stderr, "%s: cannot read game %d\n", name, game);
+        return -1;
+    }
+
+    num = collect_nodes(root, &nodes);
+    levels = malloc(num * sizeof(int));
+    for (k = 0; k < num; k++) {
+        levels[k] = nodes[k]->draw_lvl;
+        nodes[k]->draw_lvl = -1;
+    }
+    draw_levels_reference(root);
+
+    for (k = 0; k < num; k++)
+        if (nodes[k]->draw_lvl != levels[k])
+            mismatches++;
+    if (mismatches)
+        fprintf(stderr, "%s, game %d: layout differs from the original at %d of %d nodes\n",
+                name, game, mismatches, num);
+
+    free(levels);
+    free(nodes);
+    sgfFreeNode(root);
+    return mismatches;
+}/*}}}*/
+
+/* Check every game of a collection. Returns 0 if all are laid out as by the
+ * original algorithm. */
+int check_buffer(const char *buffer, size_t size, const char *name)
+{/*{{{*/
+    SGFGame *games;
+    int numGames, k, ret = 0;
+
+    numGames = sgf_index_games(buffer, size, &games);
+    if (numGames == 0) {
+        fprintf(stderr, "%s: no games\n", name);
+        ret = 1;
+    }
+    for (k=0; k<numGames; k++)
+        if (check_game(buffer + games[k].offset, games[k].length, name, k) != 0)
+            ret = 1;
+    free(games);
+
+    if (!ret)
+        printf("%s: %d games laid out as before\n", name, numGames);
+    return ret;
+}/*}}}*/
+
+int main(int argc, char *argv[])
+{/*{{{*/
+    SGFGenOptions opts;
+    char *buffer;
+    size_t size;
+    int mapped;
+    int opt, i, ret = 0;
+
+    sgfgen_defaults(&opts);
+    while ((opt = getopt(argc, argv, SGFGEN_OPTIONS)) != -1) {
+        if (!sgfgen_option(&opts, opt, optarg)) {
+            fprintf(stderr, "Usage: sgflayout_check [generator options] [file.sgf ...]\n"
+                    SGFGEN_USAGE);
+            return 2;
+        }
+    }
+
+    if (optind == argc) {
+        buffer = sgfgen_generate(&opts, &size);
+        if (!buffer) {
+            fprintf(stderr, "sgflayout_check: out of memory\n");
+            return 1;
+        }
+        ret = check_buffer(buffer, size, "generated");
+        free(buffer);
+        return ret;
+    }
+
+    for (i=optind; i<argc; i++) {
+        buffer = sgf_loadfile(argv[i], &size, &mapped);
+        if (!buffer) {
+            fprintf(stderr, "%s: cannot read file\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        ret |= check_buffer(buffer, size, argv[i]);
+        sgf_unloadfile(buffer, size, mapped);
+    }
+
+    return ret;
+}/*}}}*/
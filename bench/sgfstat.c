@@ -0,0 +1,96 @@
+/* droceRoG - memory use of SGF files
+ *
+ * Reads every game of the given files as the viewer does and prints
+ * what its tree is made of and the memory it takes, see sgfstats.c.
+ * -g reads only the given game (counting from 0), -l reads lazily,
+ * leaving variations unparsed as when a game is opened. -s prints one
+ * line per game instead, for finding the outliers of a corpus:
+ *
+ *   sgfstat -s games.sgf more.sgf | sort -n -k 3 | tail
+ *
+ * Usage: sgfstat [-g game] [-l] [-s] file.sgf ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sgftree.h"
+
+/******************************************************************************/
+
+static int flags = 0;
+static int bSummary = 0;
+
+/******************************************************************************/
+
+int print_game(const char *filename, int game);
+
+/******************************************************************************/
+
+int print_game(const char *filename, int game)
+{/*{{{*/
+    SGFTree tree;
+    SGFTreeStats stats;
+
+    sgftree_clear(&tree);
+    if (!sgftree_readgame(&tree, filename, game, flags)) {
+        fprintf(stderr, "%s: cannot read game %d\n", filename, game);
+        return 0;
+    }
+    sgftree_stats(&tree, &stats);
+
+    if (bSummary) {
+        /* file, game, total bytes, then the parts of it */
+        printf("%s %d %lu %d %d %lu %lu\n", filename, game,
+               (unsigned long) (stats.arena_bytes + stats.buffer_bytes),
+               stats.num_nodes, stats.num_props,
+               (unsigned long) (stats.value_bytes + stats.borrowed_bytes),
+               (unsigned long) stats.unparsed_bytes);
+    } else {
+        printf("%s, game %d:\n", filename, game);
+        sgfPrintTreeStats(stdout, &stats);
+        printf("\n");
+    }
+
+    sgftree_free(&tree);
+    return 1;
+}/*}}}*/
+
+int main(int argc, char *argv[])
+{/*{{{*/
+    int game = -1;
+    int opt, ok = 1;
+    int i, k, numGames;
+
+    while ((opt = getopt(argc, argv, "g:ls")) != -1) {
+        switch (opt) {
+            case 'g': game = atoi(optarg); break;
+            case 'l': flags |= SGF_READ_LAZY; break;
+            case 's': bSummary = 1; break;
+            default:
+                fprintf(stderr, "Usage: sgfstat [-g game] [-l] [-s] file.sgf ...\n");
+                return 2;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Usage: sgfstat [-g game] [-l] [-s] file.sgf ...\n");
+        return 2;
+    }
+
+    for (i=optind; i<argc; i++) {
+        if (game >= 0) {
+            ok &= print_game(argv[i], game);
+            continue;
+        }
+        numGames = sgftree_countgames(argv[i]);
+        if (numGames == 0) {
+            fprintf(stderr, "%s: no games\n", argv[i]);
+            ok = 0;
+        }
+        for (k=0; k<numGames; k++)
+            ok &= print_game(argv[i], k);
+    }
+
+    return !ok;
+}/*}}}*/
@@ -0,0 +1,143 @@
+# Generates the property tables of the SGF library from the property
+# index of the SGF specification in sgf_properties.def, see
+# SGFPropertyInfo in sgftree.h. Run by the build:
+#
+#   cmake -DINPUT=sgf_properties.def -DOUTPUT=sgf_proptable.c
+#         -P sgf_properties.cmake
+#
+# The columns of the index are fixed: identifier, description, property
+# type, value type. The index does not tell markup and annotations
+# apart from other properties, they are listed here as in the sections
+# of the specification.
+
+SET(MARKUP_PROPERTIES AR CR DD LB LN MA SL SQ TR)
+SET(ANNOTATION_PROPERTIES BM DO IT TE)
+
+# The node flags keep their narrower classes: only these properties set
+# SGF_NODE_MARKUP and SGF_NODE_SETUP, not all markup, annotation and
+# setup properties
+SET(MARKUP_NODE_PROPERTIES CR MA SQ TR BM DO IT TE)
+SET(SETUP_NODE_PROPERTIES AB AE AW)
+
+# SGF_NODE_* bits of the properties which have one of their own
+SET(NODE_FLAGS_B SGF_NODE_BLACK)
+SET(NODE_FLAGS_W SGF_NODE_WHITE)
+SET(NODE_FLAGS_C SGF_NODE_COMMENT)
+SET(NODE_FLAGS_LB SGF_NODE_LABEL)
+
+SET(LETTERS A B C D E F G H I J K L M N O P Q R S T U V W X Y Z)
+
+FILE(STRINGS ${INPUT} LINES)
+
+SET(NUM_PROPERTIES 0)
+SET(TABLE "  { 0, SGF_VALUE_UNKNOWN, 0, 0 },\n")
+
+FOREACH(LINE ${LINES})
+    STRING(LENGTH "${LINE}" LENGTH)
+    IF(NOT LINE MATCHES "^#" AND LENGTH GREATER 38)
+        STRING(REGEX MATCH "^[*!]?[A-Z]+" NAME "${LINE}")
+        STRING(REGEX REPLACE "^[*!]" "" NAME "${NAME}")
+        STRING(SUBSTRING "${LINE}" 21 17 TYPE)
+        MATH(EXPR LENGTH "${LENGTH} - 38")
+        STRING(SUBSTRING "${LINE}" 38 ${LENGTH} VALUE)
+        STRING(STRIP "${VALUE}" VALUE)
+
+        # value type, "list of" and "elist of" a type
+        SET(FLAGS "")
+        IF(VALUE MATCHES "^e?list of ")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_LIST")
+            IF(VALUE MATCHES "^elist of ")
+                SET(FLAGS "${FLAGS} | SGF_PROPERTY_ELIST")
+            ENDIF(VALUE MATCHES "^elist of ")
+            STRING(REGEX REPLACE "^e?list of " "" VALUE "${VALUE}")
+        ENDIF(VALUE MATCHES "^e?list of ")
+
+        IF(VALUE MATCHES "^\\(?number")
+            SET(VALUE_TYPE SGF_VALUE_NUMBER)
+        ELSEIF(VALUE MATCHES "^(none|real|double|color|simpletext|text|point|move|stone)$")
+            STRING(TOUPPER "SGF_VALUE_${VALUE}" VALUE_TYPE)
+        ELSE(VALUE MATCHES "^\\(?number")
+            SET(VALUE_TYPE SGF_VALUE_COMPOSED)
+        ENDIF(VALUE MATCHES "^\\(?number")
+
+        # lists of points may be compressed into rectangles
+        IF(FLAGS MATCHES "LIST" AND VALUE MATCHES "^(point|stone)$")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_RANGE")
+        ENDIF(FLAGS MATCHES "LIST" AND VALUE MATCHES "^(point|stone)$")
+
+        # class
+        SET(NODE_FLAGS 0)
+        IF(TYPE MATCHES "^setup")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_SETUP")
+        ELSEIF(TYPE MATCHES "^move")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_MOVE")
+        ELSEIF(TYPE MATCHES "^root")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_ROOT")
+        ELSEIF(TYPE MATCHES "^game-info")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_GAME_INFO")
+        ENDIF(TYPE MATCHES "^setup")
+        IF(TYPE MATCHES "\\(inherit\\)")
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_INHERIT")
+        ENDIF(TYPE MATCHES "\\(inherit\\)")
+
+        LIST(FIND MARKUP_PROPERTIES ${NAME} FOUND)
+        IF(FOUND GREATER -1)
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_MARKUP")
+        ENDIF(FOUND GREATER -1)
+        LIST(FIND ANNOTATION_PROPERTIES ${NAME} FOUND)
+        IF(FOUND GREATER -1)
+            SET(FLAGS "${FLAGS} | SGF_PROPERTY_ANNOTATION")
+        ENDIF(FOUND GREATER -1)
+        LIST(FIND MARKUP_NODE_PROPERTIES ${NAME} FOUND)
+        IF(FOUND GREATER -1)
+            SET(NODE_FLAGS SGF_NODE_MARKUP)
+        ENDIF(FOUND GREATER -1)
+        LIST(FIND SETUP_NODE_PROPERTIES ${NAME} FOUND)
+        IF(FOUND GREATER -1)
+            SET(NODE_FLAGS SGF_NODE_SETUP)
+        ENDIF(FOUND GREATER -1)
+        IF(NODE_FLAGS_${NAME})
+            SET(NODE_FLAGS ${NODE_FLAGS_${NAME}})
+        ENDIF(NODE_FLAGS_${NAME})
+
+        IF(FLAGS)
+            STRING(REGEX REPLACE "^ \\| " "" FLAGS "${FLAGS}")
+        ELSE(FLAGS)
+            SET(FLAGS 0)
+        ENDIF(FLAGS)
+
+        MATH(EXPR NUM_PROPERTIES "${NUM_PROPERTIES} + 1")
+        SET(ID_${NAME} ${NUM_PROPERTIES})
+        SET(TABLE "${TABLE}  { SGF${NAME}, ${VALUE_TYPE}, ${FLAGS}, ${NODE_FLAGS} },\n")
+    ENDIF(NOT LINE MATCHES "^#" AND LENGTH GREATER 38)
+ENDFOREACH(LINE)
+
+# the dense index, 27 slots for every first letter: the name of one
+# letter, then the second letters
+SET(IDS "")
+FOREACH(FIRST ${LETTERS})
+    SET(ROW "  ")
+    FOREACH(SECOND "" ${LETTERS})
+        IF(ID_${FIRST}${SECOND})
+            SET(ROW "${ROW}${ID_${FIRST}${SECOND}}, ")
+        ELSE(ID_${FIRST}${SECOND})
+            SET(ROW "${ROW}0, ")
+        ENDIF(ID_${FIRST}${SECOND})
+    ENDFOREACH(SECOND)
+    STRING(REGEX REPLACE " $" "" ROW "${ROW}")
+    SET(IDS "${IDS}${ROW}\n")
+ENDFOREACH(FIRST)
+
+FILE(WRITE ${OUTPUT}
+"/* Generated from sgf_properties.def by sgf_properties.cmake, do not
+ * edit. See SGFPropertyInfo in sgftree.h.
+ */
+
+#include \"sgftree.h\"
+
+const unsigned char sgf_property_ids[SGF_PROPERTY_SLOTS] = {
+${IDS}};
+
+const SGFPropertyInfo sgf_property_table[${NUM_PROPERTIES} + 1] = {
+${TABLE}};
+")
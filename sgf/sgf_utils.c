@@ -30,17 +30,21 @@
 #include "sgftree.h"
 
 /* 
- * Return the integer X move.
+ * Return the integer X move. Point properties are decoded already.
  */
 
 int
 get_moveX(SGFProperty *property, int boardsize)
 {
   int i;
-  if (strlen(property->value) < 2)
+
+  if ((property->flags & SGF_PROP_TYPE) == SGF_PROP_POINT)
+    i = property->data.point.x;
+  else if (strlen(property->value) < 2)
     return -1;
+  else
+    i = toupper((int) property->value[1]) - 'A';
 
-  i = toupper((int) property->value[1]) - 'A';
   if (i >= boardsize)
     return -1;
 
@@ -55,10 +59,14 @@ int
 get_moveY(SGFProperty *property, int boardsize)
 {
   int j;
-  if (strlen(property->value) < 2)
+
+  if ((property->flags & SGF_PROP_TYPE) == SGF_PROP_POINT)
+    j = property->data.point.y;
+  else if (strlen(property->value) < 2)
     return -1;
+  else
+    j = toupper((int) property->value[0]) - 'A';
 
-  j = toupper((int) property->value[0]) - 'A';
   if (j >= boardsize)
     return -1;
 
@@ -153,34 +161,7 @@ show_sgf_tree(SGFNode *node)
 int
 is_markup_node(SGFNode *node)
 {
-  SGFProperty *sgf_prop;
-  
-  /* If the node has no properties, there's nothing to do.
-     This should have been checked by the caller, but it can't hurt. */
-  if (!node->props)
-    return 0;
-
-  sgf_prop = node->props;
-  while (sgf_prop) {
-    switch (sgf_prop->name) {
-    case SGFCR: 
-    case SGFSQ: /* Square */
-    case SGFTR: /* Triangle */
-    case SGFMA: /* Mark */
-    case SGFBM: /* bad move */
-    case SGFDO: /* doubtful move */
-    case SGFIT: /* interesting move */
-    case SGFTE: /* good move */
-      return 1;
-      break;
-    default:
-      break;
-    }
-    sgf_prop = sgf_prop->next;
-  }
-
-  /* No markup property found. */
-  return 0;
+  return (node->flags & SGF_NODE_MARKUP) != 0;
 }
 
 
@@ -191,27 +172,7 @@ is_markup_node(SGFNode *node)
 int
 is_move_node(SGFNode *node)
 {
-  SGFProperty *sgf_prop;
-  
-  /* If the node has no properties, there's nothing to do.
-     This should have been checked by the caller, but it can't hurt. */
-  if (!node->props)
-    return 0;
-
-  sgf_prop = node->props;
-  while (sgf_prop) {
-    switch (sgf_prop->name) {
-    case SGFB: 
-    case SGFW: 
-      return 1;
-      break;
-    default:
-      break;
-    }
-    sgf_prop = sgf_prop->next;
-  }
-
-  return 0;
+  return (node->flags & SGF_NODE_MOVE) != 0;
 }
 
 
@@ -222,28 +183,11 @@ is_move_node(SGFNode *node)
 int
 is_pass_node(SGFNode *node, int boardsize)
 {
-  SGFProperty *sgf_prop;
-  int i, j;
-  
-  /* If the node has no properties, there's nothing to do.
-     This should have been checked by the caller, but it can't hurt. */
-  if (!node->props)
-    return 0;
+  if (node->flags & SGF_NODE_PASS)
+    return 1;
 
-  sgf_prop = node->props;
-  while (sgf_prop) {
-    switch (sgf_prop->name) {
-    case SGFB: 
-    case SGFW: 
-      return !get_moveXY(sgf_prop, &i, &j, boardsize);
-      break;
-    default:
-      break;
-    }
-    sgf_prop = sgf_prop->next;
-  }
-
-  return 0;
+  /* On larger boards [tt] is a move, only [] is a pass. */
+  return (node->flags & SGF_NODE_TT) && boardsize <= 19;
 }
 
 
@@ -254,32 +198,26 @@ is_pass_node(SGFNode *node, int boardsize)
 int
 find_move(SGFNode *node)
 {
-  SGFProperty *sgf_prop;
-  
-  /* If the node has no properties, there's nothing to do.
-     This should have been checked by the caller, but it can't hurt. */
-  if (!node->props)
-    return 0;
-
-  sgf_prop = node->props;
-  while (sgf_prop) {
-    switch (sgf_prop->name) {
-    case SGFB: 
-      return STONE_BLACK;
-      break;
-    case SGFW: 
-      return STONE_WHITE;
-      break;
-    default:
-      break;
-    }
-    sgf_prop = sgf_prop->next;
-  }
+  if (node->flags & SGF_NODE_BLACK)
+    return STONE_BLACK;
+  if (node->flags & SGF_NODE_WHITE)
+    return STONE_WHITE;
 
   return EMPTY;
 }
 
 
+/*
+ * Determine if the node has a comment.
+ */
+
+int
+is_comment_node(SGFNode *node)
+{
+  return (node->flags & SGF_NODE_COMMENT) != 0;
+}
+
+
 /*
  * Local Variables:
  * tab-width: 8
@@ -0,0 +1,602 @@
+/* droceRoG - compiled SGF tree cache
+ *
+ * A parsed game is stored in a binary file next to its SGF file, named
+ * FILE.sgfc (FILE.N.sgfc for game N > 0 of a collection). The file
+ * holds the nodes in pre-order, their properties and the unparsed
+ * variation ranges of a lazily read tree in flat arrays, linked by
+ * 32-bit indices instead of pointers, followed by all property values
+ * as NUL terminated strings. Variation links, draw levels and move
+ * numbers are stored as computed.
+ *
+ * The cache is valid for the SGF file with the recorded size and
+ * modification time whose game bytes have the recorded hash. The hash
+ * is only checked if the file was modified within the second the cache
+ * was written, see map_cache(). Loading maps it read-only: the nodes
+ * and properties of the tree are allocated as two arrays and
+ * relocated, the values point into the mapping.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sgftree.h"
+
+#define SGFC_MAGIC      "SGFC"
+#define SGFC_VERSION    4
+#define SGFC_BYTE_ORDER 0x01020304
+#define SGFC_NONE       0xffffffffU
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t sgf_size;
+  uint32_t sgf_mtime;
+  uint32_t game;
+  uint32_t game_offset;
+  uint32_t game_length;
+  uint32_t hash;                /* of the game bytes              */
+  uint32_t num_nodes;           /* the sections follow the header */
+  uint32_t num_props;           /* in this order                  */
+  uint32_t num_ranges;
+  uint32_t strings_size;
+} SGFCacheHeader;
+
+typedef struct {
+  uint32_t parent;              /* node indices or SGFC_NONE      */
+  uint32_t child;
+  uint32_t next;
+  uint32_t prev_var;
+  uint32_t next_var;
+  int32_t draw_lvl;
+  int32_t move_num;
+  uint32_t flags;               /* SGF_NODE_* bits                */
+  uint32_t first_prop;          /* properties of a node are       */
+  uint32_t num_props;           /* stored consecutively           */
+  uint32_t unparsed;            /* range index or SGFC_NONE       */
+} SGFCacheNode;
+
+typedef struct {
+  int16_t name;
+  int16_t flags;                /* the SGF_PROP_TYPE bits         */
+  uint32_t value;               /* offset in the strings          */
+  uint32_t data;                /* the decoded value              */
+} SGFCacheProperty;
+
+typedef struct {
+  uint32_t offset;              /* in the SGF file                */
+  uint32_t length;
+} SGFCacheRange;
+
+
+/*
+ * Name of the cache file of a game.
+ */
+
+static void
+cache_filename(const char *infilename, int game, char *buffer, int size)
+{
+  if (game > 0)
+    snprintf(buffer, size, "%s.%d.sgfc", infilename, game);
+  else
+    snprintf(buffer, size, "%s.sgfc", infilename);
+}
+
+
+/*
+ * FNV-1a hash of the game bytes.
+ */
+
+static uint32_t
+hash_bytes(const char *p, size_t length)
+{
+  uint32_t hash = 2166136261U;
+
+  while (length-- > 0) {
+    hash ^= (unsigned char) *p++;
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+
+/*
+ * Hash the unmodified bytes of a game as they are in the file. The
+ * buffer of a parsed tree cannot be used for this, the parser changes
+ * it in place.
+ */
+
+static int
+hash_game(const char *infilename, size_t offset, size_t length,
+	  uint32_t *hash)
+{
+  char *buffer;
+  size_t size;
+  int mapped;
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+  if (offset > size || length > size - offset) {
+    sgf_unloadfile(buffer, size, mapped);
+    return 0;
+  }
+
+  *hash = hash_bytes(buffer + offset, length);
+  sgf_unloadfile(buffer, size, mapped);
+  return 1;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                          Write cache                             */
+/* ---------------------------------------------------------------- */
+
+
+typedef struct {
+  SGFNode *node;
+  uint32_t index;
+} NodeIndex;
+
+static int
+compare_node_index(const void *a, const void *b)
+{
+  const NodeIndex *x = a;
+  const NodeIndex *y = b;
+
+  if (x->node < y->node)
+    return -1;
+  return x->node > y->node;
+}
+
+
+/*
+ * Index of a node in the cache, looked up in the sorted node table.
+ */
+
+static uint32_t
+node_index(NodeIndex *table, uint32_t num_nodes, SGFNode *node)
+{
+  NodeIndex key;
+  NodeIndex *found;
+
+  if (node == NULL)
+    return SGFC_NONE;
+
+  key.node = node;
+  found = bsearch(&key, table, num_nodes, sizeof(NodeIndex),
+		  compare_node_index);
+  return found ? found->index : SGFC_NONE;
+}
+
+
+/*
+ * List the nodes of a tree in pre-order, walking it like
+ * sgfFreeNode(). Returns the number of nodes.
+ */
+
+static uint32_t
+collect_nodes(SGFNode *root, SGFNode ***nodes)
+{
+  SGFNode **list = NULL;
+  SGFNode **stack = NULL;
+  uint32_t num_nodes = 0;
+  uint32_t allocated = 0;
+  int depth = 0;
+  int size = 0;
+  SGFNode *node = root;
+
+  while (node) {
+    if (num_nodes == allocated) {
+      allocated = allocated ? 2 * allocated : 1024;
+      list = xrealloc(list, allocated * sizeof(SGFNode *));
+    }
+    list[num_nodes++] = node;
+
+    if (node->next) {
+      if (depth == size) {
+	size = size ? 2 * size : 64;
+	stack = xrealloc(stack, size * sizeof(SGFNode *));
+      }
+      stack[depth++] = node->next;
+    }
+
+    if (node->child)
+      node = node->child;
+    else if (depth > 0)
+      node = stack[--depth];
+    else
+      node = NULL;
+  }
+
+  free(stack);
+  *nodes = list;
+  return num_nodes;
+}
+
+
+static int
+write_cache(FILE *file, SGFTree *tree, SGFCacheHeader *header,
+	    SGFNode **nodes, NodeIndex *table)
+{
+  uint32_t i;
+  uint32_t prop_index = 0;
+  uint32_t range_index = 0;
+  uint32_t value_offset = 0;
+  SGFProperty *prop;
+
+  if (fwrite(header, sizeof(*header), 1, file) != 1)
+    return 0;
+
+  for (i = 0; i < header->num_nodes; i++) {
+    SGFNode *node = nodes[i];
+    SGFCacheNode record;
+
+    record.parent = node_index(table, header->num_nodes, node->parent);
+    record.child = node_index(table, header->num_nodes, node->child);
+    record.next = node_index(table, header->num_nodes, node->next);
+    record.prev_var = node_index(table, header->num_nodes, node->prevVar);
+    record.next_var = node_index(table, header->num_nodes, node->nextVar);
+    record.draw_lvl = node->draw_lvl;
+    record.move_num = node->move_num;
+    record.flags = node->flags;
+    record.first_prop = prop_index;
+    record.num_props = 0;
+    for (prop = node->props; prop; prop = prop->next)
+      record.num_props++;
+    prop_index += record.num_props;
+    record.unparsed = node->unparsed ? range_index++ : SGFC_NONE;
+
+    if (fwrite(&record, sizeof(record), 1, file) != 1)
+      return 0;
+  }
+
+  for (i = 0; i < header->num_nodes; i++)
+    for (prop = nodes[i]->props; prop; prop = prop->next) {
+      SGFCacheProperty record;
+
+      record.name = prop->name;
+      record.flags = prop->flags & SGF_PROP_TYPE;
+      record.value = value_offset;
+      memcpy(&record.data, &prop->data, sizeof(record.data));
+      value_offset += strlen(prop->value) + 1;
+
+      if (fwrite(&record, sizeof(record), 1, file) != 1)
+	return 0;
+    }
+
+  for (i = 0; i < header->num_nodes; i++)
+    if (nodes[i]->unparsed) {
+      SGFCacheRange record;
+
+      record.offset = nodes[i]->unparsed->start - tree->buffer;
+      record.length = nodes[i]->unparsed->length;
+
+      if (fwrite(&record, sizeof(record), 1, file) != 1)
+	return 0;
+    }
+
+  for (i = 0; i < header->num_nodes; i++)
+    for (prop = nodes[i]->props; prop; prop = prop->next)
+      if (fwrite(prop->value, strlen(prop->value) + 1, 1, file) != 1)
+	return 0;
+
+  return 1;
+}
+
+
+/*
+ * Store the tree, read from infilename with sgftree_readgame() or
+ * sgftree_readcache(), in its cache file. The file is written under a
+ * temporary name and renamed, so a mapping of the old cache stays
+ * valid. Returns 1 on success.
+ */
+
+int
+sgftree_writecache(SGFTree *tree, const char *infilename)
+{
+  SGFCacheHeader header;
+  SGFNode **nodes;
+  NodeIndex *table;
+  SGFProperty *prop;
+  struct stat st;
+  char filename[1024];
+  char tmpname[1040];
+  uint32_t i;
+  FILE *file;
+  int ok;
+
+  /* the journal is replayed onto the cached tree */
+  if (tree->root == NULL || tree->buffer == NULL || tree->edited)
+    return 0;
+  if (stat(infilename, &st) != 0 || (uint64_t) st.st_size > SGFC_NONE)
+    return 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SGFC_MAGIC, 4);
+  header.version = SGFC_VERSION;
+  header.byte_order = SGFC_BYTE_ORDER;
+  header.sgf_size = st.st_size;
+  header.sgf_mtime = st.st_mtime;
+  header.game = tree->game;
+  header.game_offset = tree->game_offset;
+  header.game_length = tree->game_length;
+  if (!hash_game(infilename, tree->game_offset, tree->game_length,
+		 &header.hash))
+    return 0;
+
+  header.num_nodes = collect_nodes(tree->root, &nodes);
+  table = xalloc(header.num_nodes * sizeof(NodeIndex));
+  for (i = 0; i < header.num_nodes; i++) {
+    table[i].node = nodes[i];
+    table[i].index = i;
+    if (nodes[i]->unparsed)
+      header.num_ranges++;
+    for (prop = nodes[i]->props; prop; prop = prop->next) {
+      header.num_props++;
+      header.strings_size += strlen(prop->value) + 1;
+    }
+  }
+  qsort(table, header.num_nodes, sizeof(NodeIndex), compare_node_index);
+
+  cache_filename(infilename, tree->game, filename, sizeof(filename));
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+  file = fopen(tmpname, "wb");
+  ok = file != NULL;
+  if (ok) {
+    ok = write_cache(file, tree, &header, nodes, table);
+    if (fclose(file) != 0)
+      ok = 0;
+    if (ok)
+      ok = rename(tmpname, filename) == 0;
+    if (!ok)
+      remove(tmpname);
+  }
+
+  free(table);
+  free(nodes);
+  return ok;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                           Read cache                             */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Map a cache file and check that it belongs to the current contents
+ * of the SGF file. Returns the mapping or NULL.
+ */
+
+static char *
+map_cache(const char *infilename, int game, size_t *size)
+{
+  SGFCacheHeader *header;
+  struct stat st, sgf_st;
+  char filename[1024];
+  uint64_t expected;
+  uint32_t hash;
+  char *cache;
+  int fd;
+
+  if (stat(infilename, &sgf_st) != 0)
+    return NULL;
+
+  cache_filename(infilename, game, filename, sizeof(filename));
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SGFCacheHeader)) {
+    close(fd);
+    return NULL;
+  }
+  cache = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (cache == MAP_FAILED)
+    return NULL;
+  *size = st.st_size;
+
+  header = (SGFCacheHeader *) cache;
+  expected = sizeof(SGFCacheHeader)
+    + (uint64_t) header->num_nodes * sizeof(SGFCacheNode)
+    + (uint64_t) header->num_props * sizeof(SGFCacheProperty)
+    + (uint64_t) header->num_ranges * sizeof(SGFCacheRange)
+    + header->strings_size;
+
+  if (memcmp(header->magic, SGFC_MAGIC, 4) != 0
+      || header->version != SGFC_VERSION
+      || header->byte_order != SGFC_BYTE_ORDER
+      || header->sgf_size != (uint64_t) sgf_st.st_size
+      || header->sgf_mtime != (uint32_t) sgf_st.st_mtime
+      || header->game != (uint32_t) game
+      || header->num_nodes == 0
+      || expected != *size
+      || (header->strings_size > 0 && cache[*size - 1] != '\0')
+      || header->game_offset > header->sgf_size
+      || header->game_length > header->sgf_size - header->game_offset) {
+    munmap(cache, *size);
+    return NULL;
+  }
+
+  /* A change after the cache was written gives the file a later mtime,
+   * unless it happened within the second of the recorded one, which is
+   * then at least the mtime of the cache. Only in that case the game
+   * bytes are read and hashed. */
+  if (sgf_st.st_mtime >= st.st_mtime
+      && (!hash_game(infilename, header->game_offset, header->game_length,
+		     &hash)
+	  || hash != header->hash)) {
+    munmap(cache, *size);
+    return NULL;
+  }
+
+  return cache;
+}
+
+
+static SGFNode *
+node_pointer(SGFNode *nodes, uint32_t num_nodes, uint32_t index, int *ok)
+{
+  if (index == SGFC_NONE)
+    return NULL;
+  if (index >= num_nodes) {
+    *ok = 0;
+    return NULL;
+  }
+  return &nodes[index];
+}
+
+
+/*
+ * Build the tree from a mapped cache. All nodes and all properties are
+ * allocated as one array each from the arena. Returns NULL if the
+ * cache is inconsistent.
+ */
+
+static SGFNode *
+load_cache(char *cache, char *buffer, size_t buffer_size, SGFArena *arena)
+{
+  SGFCacheHeader *header = (SGFCacheHeader *) cache;
+  SGFCacheNode *cnodes = (SGFCacheNode *) (header + 1);
+  SGFCacheProperty *cprops = (SGFCacheProperty *) (cnodes
+						    + header->num_nodes);
+  SGFCacheRange *cranges = (SGFCacheRange *) (cprops + header->num_props);
+  char *strings = (char *) (cranges + header->num_ranges);
+  uint32_t num_nodes = header->num_nodes;
+  SGFNode *nodes;
+  SGFProperty *props = NULL;
+  SGFRange *ranges = NULL;
+  uint32_t i, j;
+  int ok = 1;
+
+  if (num_nodes > UINT32_MAX / sizeof(SGFNode)
+      || header->num_props > UINT32_MAX / sizeof(SGFProperty)
+      || header->num_ranges > UINT32_MAX / sizeof(SGFRange))
+    return NULL;
+
+  nodes = sgfArenaAlloc(arena, num_nodes * sizeof(SGFNode));
+  if (header->num_props > 0)
+    props = sgfArenaAlloc(arena, header->num_props * sizeof(SGFProperty));
+  if (header->num_ranges > 0)
+    ranges = sgfArenaAlloc(arena, header->num_ranges * sizeof(SGFRange));
+
+  for (i = 0; i < header->num_props; i++) {
+    if (cprops[i].value >= header->strings_size)
+      return NULL;
+    props[i].next = NULL;
+    props[i].name = cprops[i].name;
+    props[i].flags = SGF_PROP_BORROWED | (cprops[i].flags & SGF_PROP_TYPE);
+    memcpy(&props[i].data, &cprops[i].data, sizeof(props[i].data));
+    props[i].value = strings + cprops[i].value;
+  }
+
+  for (i = 0; i < header->num_ranges; i++) {
+    if (cranges[i].offset > buffer_size
+	|| cranges[i].length > buffer_size - cranges[i].offset)
+      return NULL;
+    ranges[i].start = buffer + cranges[i].offset;
+    ranges[i].length = cranges[i].length;
+  }
+
+  for (i = 0; i < num_nodes; i++) {
+    SGFCacheNode *cnode = &cnodes[i];
+    SGFNode *node = &nodes[i];
+
+    node->parent = node_pointer(nodes, num_nodes, cnode->parent, &ok);
+    node->child = node_pointer(nodes, num_nodes, cnode->child, &ok);
+    node->next = node_pointer(nodes, num_nodes, cnode->next, &ok);
+    node->prevVar = node_pointer(nodes, num_nodes, cnode->prev_var, &ok);
+    node->nextVar = node_pointer(nodes, num_nodes, cnode->next_var, &ok);
+    node->draw_lvl = cnode->draw_lvl;
+    node->move_num = cnode->move_num;
+    node->flags = cnode->flags;
+
+    node->props = NULL;
+    if (cnode->num_props > 0) {
+      if (cnode->first_prop > header->num_props
+	  || cnode->num_props > header->num_props - cnode->first_prop)
+	return NULL;
+      node->props = &props[cnode->first_prop];
+      for (j = 1; j < cnode->num_props; j++)
+	props[cnode->first_prop + j - 1].next = &props[cnode->first_prop + j];
+    }
+
+    node->unparsed = NULL;
+    if (cnode->unparsed != SGFC_NONE) {
+      if (cnode->unparsed >= header->num_ranges)
+	return NULL;
+      node->unparsed = &ranges[cnode->unparsed];
+    }
+  }
+
+  return ok ? &nodes[0] : NULL;
+}
+
+
+/*
+ * Read game number game of infilename from its cache file, if there is
+ * a valid one. The SGF file is mapped as well: lazily read variations
+ * are parsed from it. Returns 1 on success; otherwise the tree is left
+ * untouched.
+ */
+
+int
+sgftree_readcache(SGFTree *tree, const char *infilename, int game)
+{
+  SGFCacheHeader *header;
+  SGFNode *root;
+  SGFArena arena;
+  char *cache;
+  size_t cache_size;
+  char *buffer;
+  size_t size;
+  int mapped;
+
+  cache = map_cache(infilename, game, &cache_size);
+  if (cache == NULL)
+    return 0;
+  header = (SGFCacheHeader *) cache;
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL) {
+    munmap(cache, cache_size);
+    return 0;
+  }
+
+  sgfArenaInit(&arena);
+  root = load_cache(cache, buffer, size, &arena);
+  if (root == NULL) {
+    sgfArenaFree(&arena);
+    sgf_unloadfile(buffer, size, mapped);
+    munmap(cache, cache_size);
+    return 0;
+  }
+
+  sgftree_free(tree);
+  tree->root = root;
+  tree->arena = arena;
+  tree->buffer = buffer;
+  tree->buffer_size = size;
+  tree->buffer_mapped = mapped;
+  tree->game = game;
+  tree->game_offset = header->game_offset;
+  tree->game_length = header->game_length;
+  tree->cache = cache;
+  tree->cache_size = cache_size;
+  return 1;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
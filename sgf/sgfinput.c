@@ -0,0 +1,413 @@
+/* droceRoG - compressed SGF input
+ *
+ * Game collections are often distributed compressed. A gzip file
+ * (.sgf.gz) is not inflated into memory as a whole: zlib decompresses
+ * it a chunk at a time as the parser asks for more input, see
+ * sgfparser_init_stream(). The same goes for the entries of a ZIP
+ * archive, which are named by the path of the archive followed by
+ * their path inside it: "games.zip/kisei/game1.sgf". The archive is
+ * never unpacked; its central directory lists the entries, and an
+ * entry is read from its position in the archive, stored or deflated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "sgftree.h"
+
+/* ZIP headers, all numbers are little endian */
+#define ZIP_LOCAL_SIG     0x04034b50
+#define ZIP_CENTRAL_SIG   0x02014b50
+#define ZIP_END_SIG       0x06054b50
+#define ZIP_LOCAL_SIZE    30
+#define ZIP_CENTRAL_SIZE  46
+#define ZIP_END_SIZE      22
+#define ZIP_COMMENT_MAX   65535
+
+#define ZIP_STORED        0
+#define ZIP_DEFLATED      8
+#define ZIP_ENCRYPTED     0x0001
+
+#define ZIP_CHUNK         16384
+
+#define GET16(p) ((unsigned) (p)[0] | (unsigned) (p)[1] << 8)
+#define GET32(p) (GET16(p) | (unsigned long) GET16((p) + 2) << 16)
+
+
+/* ---------------------------------------------------------------- */
+/*                               gzip                               */
+/* ---------------------------------------------------------------- */
+
+
+static int
+is_gzip(const char *filename)
+{
+  size_t len = strlen(filename);
+
+  return len >= 3 && strcmp(filename + len - 3, ".gz") == 0;
+}
+
+
+static int
+gzip_read(void *source, char *buf, unsigned int size)
+{
+  return gzread((gzFile) source, buf, size);
+}
+
+
+static void
+gzip_close(void *source)
+{
+  gzclose((gzFile) source);
+}
+
+
+/*
+ * Open a gzip file as a stream. A file which is not compressed after
+ * all is read as it is. Returns 0 if the file will not open.
+ */
+
+static int
+open_gzip(SGFStream *stream, const char *filename)
+{
+  gzFile file = gzopen(filename, "rb");
+
+  if (file == NULL)
+    return 0;
+
+  stream->read = gzip_read;
+  stream->close = gzip_close;
+  stream->source = file;
+  return 1;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                           ZIP archives                           */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Return the length of the archive part of the name of an entry, up
+ * to and including ".zip", or 0 if filename names no entry.
+ */
+
+static size_t
+zip_split(const char *filename)
+{
+  const char *p;
+
+  for (p = strchr(filename, '/'); p; p = strchr(p + 1, '/'))
+    if (p - filename >= 4 && strncasecmp(p - 4, ".zip", 4) == 0 && p[1])
+      return p - filename;
+  return 0;
+}
+
+
+/*
+ * Read the central directory of an archive. Returns it in an allocated
+ * buffer, with its size and the number of entries, or NULL if file is
+ * not a ZIP archive. Archives with a comment are found as well, ZIP64
+ * archives are not supported.
+ */
+
+static unsigned char *
+zip_directory(FILE *file, size_t *size, int *entries)
+{
+  unsigned char *tail, *p, *dir;
+  unsigned long offset;
+  long len, n;
+
+  if (fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) < ZIP_END_SIZE)
+    return NULL;
+
+  /* the end record is followed by a comment of up to 64 KB */
+  n = len < ZIP_END_SIZE + ZIP_COMMENT_MAX ? len : ZIP_END_SIZE + ZIP_COMMENT_MAX;
+  tail = malloc(n);
+  if (tail == NULL || fseek(file, len - n, SEEK_SET) != 0
+      || fread(tail, 1, n, file) != (size_t) n) {
+    free(tail);
+    return NULL;
+  }
+  for (p = tail + n - ZIP_END_SIZE; GET32(p) != ZIP_END_SIG; p--)
+    if (p == tail) {
+      free(tail);
+      return NULL;
+    }
+
+  *entries = GET16(p + 10);
+  *size = GET32(p + 12);
+  offset = GET32(p + 16);
+  free(tail);
+  if (offset + *size > (unsigned long) len)
+    return NULL;
+
+  dir = malloc(*size ? *size : 1);
+  if (dir == NULL || fseek(file, offset, SEEK_SET) != 0
+      || fread(dir, 1, *size, file) != *size) {
+    free(dir);
+    return NULL;
+  }
+  return dir;
+}
+
+
+/*
+ * Return the next entry of a central directory, NULL behind the last
+ * one or if the directory is damaged.
+ */
+
+static unsigned char *
+zip_next_entry(unsigned char *dir, size_t size, unsigned char *entry)
+{
+  unsigned char *end = dir + size;
+
+  if (entry == NULL)
+    entry = dir;
+  else
+    entry += ZIP_CENTRAL_SIZE + GET16(entry + 28) + GET16(entry + 30)
+      + GET16(entry + 32);
+
+  if (end - entry < ZIP_CENTRAL_SIZE || GET32(entry) != ZIP_CENTRAL_SIG
+      || end - entry < ZIP_CENTRAL_SIZE + GET16(entry + 28))
+    return NULL;
+  return entry;
+}
+
+
+/*
+ * List the files in a ZIP archive, from its central directory. Returns
+ * the number of files and stores their names in an array in *names,
+ * which the caller must free (the names are in the same allocation).
+ * Directories are left out. Returns 0 if the file is not an archive.
+ */
+
+int
+sgf_zip_list(const char *zipname, char ***names)
+{
+  unsigned char *dir, *entry;
+  size_t size;
+  int entries, num = 0;
+  char **list, *text;
+  FILE *file;
+
+  *names = NULL;
+  file = fopen(zipname, "rb");
+  if (file == NULL)
+    return 0;
+  dir = zip_directory(file, &size, &entries);
+  fclose(file);
+  if (dir == NULL)
+    return 0;
+
+  /* the names take less room than the directory entries */
+  list = malloc(entries * sizeof(char *) + size);
+  if (list == NULL) {
+    free(dir);
+    return 0;
+  }
+  text = (char *) (list + entries);
+
+  entry = NULL;
+  while (num < entries && (entry = zip_next_entry(dir, size, entry))) {
+    unsigned len = GET16(entry + 28);
+
+    if (len == 0 || entry[ZIP_CENTRAL_SIZE + len - 1] == '/')
+      continue;
+    memcpy(text, entry + ZIP_CENTRAL_SIZE, len);
+    text[len] = '\0';
+    list[num++] = text;
+    text += len + 1;
+  }
+
+  free(dir);
+  *names = list;
+  return num;
+}
+
+
+/*
+ * An entry of an archive being read.
+ */
+
+typedef struct SGFZipSource_t {
+  FILE *file;
+  int method;
+  unsigned long remaining;      /* compressed bytes not read yet  */
+  z_stream z;
+  unsigned char in[ZIP_CHUNK];
+} SGFZipSource;
+
+
+static int
+zip_read(void *source, char *buf, unsigned int size)
+{
+  SGFZipSource *zip = source;
+  z_stream *z = &zip->z;
+  size_t n;
+
+  if (zip->method == ZIP_STORED) {
+    n = size < zip->remaining ? size : zip->remaining;
+    if (fread(buf, 1, n, zip->file) != n)
+      return -1;
+    zip->remaining -= n;
+    return n;
+  }
+
+  z->next_out = (unsigned char *) buf;
+  z->avail_out = size;
+  while (z->avail_out == size) {
+    int ret;
+
+    if (z->avail_in == 0 && zip->remaining > 0) {
+      n = sizeof(zip->in) < zip->remaining ? sizeof(zip->in) : zip->remaining;
+      if (fread(zip->in, 1, n, zip->file) != n)
+	return -1;
+      zip->remaining -= n;
+      z->next_in = zip->in;
+      z->avail_in = n;
+    }
+    ret = inflate(z, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+      break;
+    if (ret != Z_OK)
+      return -1;		/* damaged or truncated */
+  }
+  return size - z->avail_out;
+}
+
+
+static void
+zip_close(void *source)
+{
+  SGFZipSource *zip = source;
+
+  if (zip->method == ZIP_DEFLATED)
+    inflateEnd(&zip->z);
+  fclose(zip->file);
+  free(zip);
+}
+
+
+/*
+ * Open the entry of an archive named by filename as a stream, see
+ * zip_split(). Returns 0 if there is no such entry, or if it is
+ * encrypted or compressed with another method than deflate.
+ */
+
+static int
+open_zip_entry(SGFStream *stream, const char *filename, size_t split)
+{
+  const char *name = filename + split + 1;
+  size_t namelen = strlen(name);
+  unsigned char *dir, *entry;
+  unsigned char local[ZIP_LOCAL_SIZE];
+  unsigned long offset = 0;
+  SGFZipSource *zip;
+  char *zipname;
+  size_t size;
+  int entries;
+
+  zip = malloc(sizeof(SGFZipSource));
+  zipname = malloc(split + 1);
+  if (zip == NULL || zipname == NULL) {
+    free(zip);
+    free(zipname);
+    return 0;
+  }
+  memcpy(zipname, filename, split);
+  zipname[split] = '\0';
+  zip->file = fopen(zipname, "rb");
+  free(zipname);
+  if (zip->file == NULL) {
+    free(zip);
+    return 0;
+  }
+
+  /* find the entry in the central directory */
+  entry = NULL;
+  dir = zip_directory(zip->file, &size, &entries);
+  if (dir) {
+    while ((entry = zip_next_entry(dir, size, entry)))
+      if (GET16(entry + 28) == namelen
+	  && memcmp(entry + ZIP_CENTRAL_SIZE, name, namelen) == 0)
+	break;
+  }
+  if (entry && !(GET16(entry + 8) & ZIP_ENCRYPTED)) {
+    zip->method = GET16(entry + 10);
+    zip->remaining = GET32(entry + 20);
+    offset = GET32(entry + 42);
+  }
+  else
+    zip->method = -1;
+  free(dir);
+
+  /* the data follows the local header, whose extra field may differ
+   * from the one in the central directory */
+  if ((zip->method != ZIP_STORED && zip->method != ZIP_DEFLATED)
+      || fseek(zip->file, offset, SEEK_SET) != 0
+      || fread(local, 1, ZIP_LOCAL_SIZE, zip->file) != ZIP_LOCAL_SIZE
+      || GET32(local) != ZIP_LOCAL_SIG
+      || fseek(zip->file, GET16(local + 26) + GET16(local + 28), SEEK_CUR) != 0) {
+    fclose(zip->file);
+    free(zip);
+    return 0;
+  }
+
+  if (zip->method == ZIP_DEFLATED) {
+    memset(&zip->z, 0, sizeof(zip->z));
+    if (inflateInit2(&zip->z, -MAX_WBITS) != Z_OK) {
+      fclose(zip->file);
+      free(zip);
+      return 0;
+    }
+  }
+
+  stream->read = zip_read;
+  stream->close = zip_close;
+  stream->source = zip;
+  return 1;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                         Opening streams                          */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Whether filename names a gzip compressed file or an entry of a ZIP
+ * archive, which are read as streams.
+ */
+
+int
+sgf_is_compressed(const char *filename)
+{
+  return zip_split(filename) > 0 || is_gzip(filename);
+}
+
+
+/*
+ * Open a compressed file as a stream. Returns 0 if it will not open.
+ */
+
+int
+sgf_open_compressed(SGFStream *stream, const char *filename)
+{
+  size_t split = zip_split(filename);
+
+  if (split > 0)
+    return open_zip_entry(stream, filename, split);
+  return open_gzip(stream, filename);
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
@@ -0,0 +1,534 @@
+/* droceRoG - annotation journal
+ *
+ * Annotations made while viewing a game are not saved by writing the
+ * whole SGF file again. Each one is appended as a line to a journal
+ * next to the file, named FILE.sgfj (FILE.N.sgfj for game N > 0 of a
+ * collection), so saving costs the size of the edit. The journal is
+ * replayed onto the tree when the game is read again, and folded into
+ * the SGF file only by sgftree_export().
+ *
+ * A record is one line of four fields separated by a space:
+ *
+ *   C <path> C <text>           text added to the comment of a node
+ *   M <path> <NAME> <value>     property added to a node, e.g. markup
+ *   V <path> <NAME> <value>     new last child holding one property
+ *
+ * The path addresses a node by the child indices leading to it from
+ * the root, separated by '.', where "i*n" stands for n times i; the
+ * root itself is "-". In the value, a backslash, newline and carriage
+ * return are written as "\\", "\n" and "\r". A last line without its
+ * newline is an interrupted write and is ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sgftree.h"
+
+
+/*
+ * Name of the journal of a game.
+ */
+
+static void
+journal_filename(const char *infilename, int game, char *buffer, int size)
+{
+  if (game > 0)
+    snprintf(buffer, size, "%s.%d.sgfj", infilename, game);
+  else
+    snprintf(buffer, size, "%s.sgfj", infilename);
+}
+
+
+/*
+ * Nodes and properties go into the arena of a tree read from a file,
+ * but on the heap for a tree built with the node level functions.
+ */
+
+static SGFArena *
+tree_arena(SGFTree *tree)
+{
+  return tree->arena.blocks ? &tree->arena : NULL;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                           Node paths                             */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Return the path of node, see above, in an allocated string.
+ */
+
+static char *
+node_path(SGFNode *node)
+{
+  int *index;
+  int depth = 0;
+  int k, n;
+  SGFNode *p, *q;
+  char *path, *s;
+
+  for (p = node; p->parent; p = p->parent)
+    depth++;
+  if (depth == 0) {
+    path = xalloc(2);
+    strcpy(path, "-");
+    return path;
+  }
+
+  index = xalloc(depth * sizeof(int));
+  for (p = node, k = depth; p->parent; p = p->parent) {
+    n = 0;
+    for (q = p->parent->child; q != p; q = q->next)
+      n++;
+    index[--k] = n;
+  }
+
+  /* at most 2 * 11 characters and '*' and '.' per index */
+  path = xalloc(depth * 24 + 1);
+  s = path;
+  for (k = 0; k < depth; k += n) {
+    for (n = 1; k + n < depth && index[k + n] == index[k]; n++)
+      ;
+    if (k > 0)
+      *s++ = '.';
+    if (n > 1)
+      s += sprintf(s, "%d*%d", index[k], n);
+    else
+      s += sprintf(s, "%d", index[k]);
+  }
+  free(index);
+  return path;
+}
+
+
+/*
+ * Find the node with path in a tree. Variations of a lazily read tree
+ * are parsed on the way. Returns NULL if there is no such node.
+ */
+
+static SGFNode *
+find_node(SGFTree *tree, const char *path)
+{
+  SGFNode *node = tree->root;
+  char *end;
+  long index, count;
+
+  if (strcmp(path, "-") == 0)
+    return node;
+
+  for (;;) {
+    index = strtol(path, &end, 10);
+    if (end == path || index < 0)
+      return NULL;
+    count = 1;
+    if (*end == '*') {
+      path = end + 1;
+      count = strtol(path, &end, 10);
+      if (end == path || count < 1)
+	return NULL;
+    }
+
+    while (count-- > 0) {
+      SGFNode *child;
+      long k;
+
+      if (index > 0)
+	sgftreeExpandVariations(tree, node);
+      for (k = 0, child = node->child; child && k < index; k++)
+	child = child->next;
+      if (child == NULL)
+	return NULL;
+      node = child;
+    }
+
+    if (*end == '\0')
+      return node;
+    if (*end != '.')
+      return NULL;
+    path = end + 1;
+  }
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                            Records                               */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Return value with the escapes of a record in an allocated string.
+ */
+
+static char *
+escape_value(const char *value)
+{
+  char *text = xalloc(2 * strlen(value) + 1);
+  char *s = text;
+
+  for (; *value; value++) {
+    if (*value == '\\' || *value == '\n' || *value == '\r') {
+      *s++ = '\\';
+      *s++ = *value == '\n' ? 'n' : *value == '\r' ? 'r' : '\\';
+    }
+    else
+      *s++ = *value;
+  }
+  *s = '\0';
+  return text;
+}
+
+
+/*
+ * Undo escape_value() in place.
+ */
+
+static void
+unescape_value(char *value)
+{
+  char *s = value;
+
+  for (; *value; value++) {
+    if (*value == '\\' && value[1]) {
+      value++;
+      *s++ = *value == 'n' ? '\n' : *value == 'r' ? '\r' : *value;
+    }
+    else
+      *s++ = *value;
+  }
+  *s = '\0';
+}
+
+
+/*
+ * Property names are one or two upper case letters.
+ */
+
+static int
+valid_name(const char *name)
+{
+  return name[0] >= 'A' && name[0] <= 'Z'
+    && (name[1] == '\0'
+	|| (name[1] >= 'A' && name[1] <= 'Z' && name[2] == '\0'));
+}
+
+
+/*
+ * The SGFxx identifier of a valid name, as mk_property() stores it.
+ */
+
+static short
+property_name(const char *name)
+{
+  if (name[1] == '\0')
+    return name[0] | (short) (' ' << 8);
+  return name[0] | name[1] << 8;
+}
+
+
+/*
+ * Does node have the property name with this value already?
+ */
+
+static int
+has_marker(SGFNode *node, const char *name, const char *value)
+{
+  SGFProperty *prop;
+  short sgf_name = property_name(name);
+
+  for (prop = node->props; prop; prop = prop->next)
+    if (prop->name == sgf_name && !strcmp(prop->value, value))
+      return 1;
+  return 0;
+}
+
+
+/*
+ * Append a record for node to the journal of the tree, with a single
+ * write. Returns 1 on success.
+ */
+
+static int
+append_record(SGFTree *tree, char kind, SGFNode *node, const char *name,
+	      const char *value)
+{
+  char *path, *text, *record;
+  size_t size;
+  FILE *file;
+  int ok;
+
+  if (tree->journal == NULL || !valid_name(name))
+    return 0;
+
+  path = node_path(node);
+  text = escape_value(value);
+  size = strlen(path) + strlen(name) + strlen(text) + 6;
+  record = xalloc(size + 1);
+  size = snprintf(record, size + 1, "%c %s %s %s\n", kind, path, name, text);
+
+  file = fopen(tree->journal, "a");
+  ok = file != NULL;
+  if (ok) {
+    ok = fwrite(record, 1, size, file) == size;
+    if (fclose(file) != 0)
+      ok = 0;
+  }
+
+  free(record);
+  free(text);
+  free(path);
+  return ok;
+}
+
+
+/*
+ * Apply a record to the tree. The variation links are not updated.
+ * Returns the node changed or added, NULL if the record does not fit
+ * the tree.
+ */
+
+static SGFNode *
+apply_record(SGFTree *tree, char kind, SGFNode *node, const char *name,
+	     const char *value)
+{
+  SGFArena *arena = tree_arena(tree);
+
+  switch (kind) {
+  case 'C':
+    sgfArenaAddComment(node, value, arena);
+    return node;
+  case 'M':
+    /* only a list takes more values, other properties are replaced */
+    if (sgf_property_info(property_name(name))->flags & SGF_PROPERTY_LIST)
+      sgfArenaAddProperty(node, name, value, arena);
+    else
+      sgfArenaOverwriteProperty(node, name, value, arena);
+    return node;
+  case 'V':
+    /* the new variation goes behind the ones still to be parsed */
+    sgftreeExpandVariations(tree, node);
+    node = sgfArenaAddChild(node, arena);
+    sgfArenaAddProperty(node, name, value, arena);
+    return node;
+  }
+  return NULL;
+}
+
+
+/*
+ * Replay the lines of a journal in buffer onto the tree. Returns the
+ * number of records applied.
+ */
+
+static int
+replay(SGFTree *tree, char *buffer, size_t size)
+{
+  char *line = buffer;
+  char *end = buffer + size;
+  char *eol, *fields[4];
+  SGFNode *node;
+  int num = 0;
+  int k;
+
+  while ((eol = memchr(line, '\n', end - line)) != NULL) {
+    *eol = '\0';
+    fields[0] = line;
+    for (k = 1; k < 4; k++) {
+      fields[k] = strchr(fields[k - 1], ' ');
+      if (fields[k] == NULL)
+	break;
+      *fields[k]++ = '\0';
+    }
+    line = eol + 1;
+
+    if (k < 4 || strlen(fields[0]) != 1 || !valid_name(fields[2]))
+      continue;
+    node = find_node(tree, fields[1]);
+    if (node == NULL)
+      continue;
+    unescape_value(fields[3]);
+    if (apply_record(tree, fields[0][0], node, fields[2], fields[3]))
+      num++;
+  }
+  return num;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                          Journal API                             */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Replay the journal of a tree just read from infilename, and direct
+ * the annotations made from now on to it. Returns the number of edits
+ * replayed.
+ */
+
+int
+sgftree_readjournal(SGFTree *tree, const char *infilename)
+{
+  char filename[1024];
+  char *buffer;
+  size_t size;
+  int mapped;
+  int num;
+
+  if (tree->root == NULL)
+    return 0;
+
+  journal_filename(infilename, tree->game, filename, sizeof(filename));
+  free(tree->journal);
+  tree->journal = xalloc(strlen(filename) + 1);
+  strcpy(tree->journal, filename);
+
+  buffer = sgf_loadfile(filename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+  num = replay(tree, buffer, size);
+  sgf_unloadfile(buffer, size, mapped);
+
+  if (num > 0) {
+    sgfRelinkTree(tree->root);
+    tree->edited = 1;
+  }
+  return num;
+}
+
+
+/*
+ * Add text to the comment of node. Returns 0 if it could not be saved
+ * in the journal, in which case the tree is not changed either.
+ */
+
+int
+sgftree_journal_comment(SGFTree *tree, SGFNode *node, const char *text)
+{
+  if (!append_record(tree, 'C', node, "C", text))
+    return 0;
+  apply_record(tree, 'C', node, "C", text);
+  tree->edited = 1;
+  return 1;
+}
+
+
+/*
+ * Add a property such as markup to node, or add a value to it if it is
+ * a list; a property which is not a list gets the new value instead.
+ * Nothing is recorded if node has this value already. Returns 0 if it
+ * could not be saved in the journal.
+ */
+
+int
+sgftree_journal_marker(SGFTree *tree, SGFNode *node, const char *name,
+		       const char *value)
+{
+  if (has_marker(node, name, value))
+    return 1;
+  if (!append_record(tree, 'M', node, name, value))
+    return 0;
+  apply_record(tree, 'M', node, name, value);
+  tree->edited = 1;
+  return 1;
+}
+
+
+/*
+ * Add a new variation after the last one of node, starting with a node
+ * holding the property name, usually a move. Returns the new node, or
+ * NULL if it could not be saved in the journal.
+ */
+
+SGFNode *
+sgftree_journal_variation(SGFTree *tree, SGFNode *node, const char *name,
+			  const char *value)
+{
+  SGFNode *child;
+
+  /* the path of the new node must count the variations not yet parsed */
+  sgftreeExpandVariations(tree, node);
+  if (!append_record(tree, 'V', node, name, value))
+    return NULL;
+  child = apply_record(tree, 'V', node, name, value);
+  sgfRelinkTree(tree->root);
+  tree->edited = 1;
+  return child;
+}
+
+
+/*
+ * Fold the journal into the SGF file: the game is read again
+ * completely, the journal replayed onto it and written in place of the
+ * original game, the other games of a collection are kept as they
+ * are. The file is written under a temporary name and renamed, and
+ * the journal removed. The tree itself stays valid. Compressed files
+ * cannot be exported. Returns 1 on success.
+ */
+
+int
+sgftree_export(SGFTree *tree, const char *infilename)
+{
+  SGFTree game;
+  SGFGame *games;
+  char tmpname[1040];
+  char *buffer;
+  size_t size, end;
+  int mapped;
+  int num_games;
+  FILE *file;
+  int ok;
+
+  if (tree->journal == NULL || sgf_is_compressed(infilename))
+    return 0;
+
+  sgftree_clear(&game);
+  if (!sgftree_readgame(&game, infilename, tree->game, 0))
+    return 0;
+  sgftree_readjournal(&game, infilename);
+
+  /* the games around it, from a buffer of its own */
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL) {
+    sgftree_free(&game);
+    return 0;
+  }
+  num_games = sgf_index_games(buffer, size, &games);
+  ok = tree->game < num_games;
+
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", infilename);
+  file = ok ? fopen(tmpname, "wb") : NULL;
+  if (file != NULL) {
+    end = games[tree->game].offset + games[tree->game].length;
+    ok = fwrite(buffer, 1, games[tree->game].offset, file)
+      == games[tree->game].offset;
+    ok &= fwritesgf(game.root, file);
+    ok &= fwrite(buffer + end, 1, size - end, file) == size - end;
+    if (fclose(file) != 0)
+      ok = 0;
+    if (ok)
+      ok = rename(tmpname, infilename) == 0;
+    if (!ok)
+      remove(tmpname);
+    if (ok)
+      unlink(tree->journal);
+  }
+  else
+    ok = 0;
+
+  free(games);
+  sgf_unloadfile(buffer, size, mapped);
+  sgftree_free(&game);
+  return ok;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
@@ -32,7 +32,15 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
+#include <setjmp.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 #if TIME_WITH_SYS_TIME
@@ -94,20 +102,126 @@ xrealloc(void *pt, unsigned int size)
 }
 
 
+/*
+ * Utility: a bump allocator for the nodes and properties of a tree.
+ * Blocks double in size up to SGF_ARENA_MAX_BLOCK, so even huge trees
+ * are held in a few dozen blocks which are released in one sweep.
+ */
+
+#define SGF_ARENA_MIN_BLOCK 65536
+#define SGF_ARENA_MAX_BLOCK (4 * 1024 * 1024)
+#define SGF_ARENA_ALIGN 8
+
+/* Size of the block header, keeping the data behind it aligned. */
+#define SGF_ARENA_HEADER \
+  ((sizeof(SGFArenaBlock) + SGF_ARENA_ALIGN - 1) & ~(SGF_ARENA_ALIGN - 1))
+
+void
+sgfArenaInit(SGFArena *arena)
+{
+  arena->blocks = NULL;
+  arena->ptr = NULL;
+  arena->end = NULL;
+}
+
+void *
+sgfArenaAlloc(SGFArena *arena, unsigned int size)
+{
+  void *pt;
+
+  size = (size + SGF_ARENA_ALIGN - 1) & ~(SGF_ARENA_ALIGN - 1);
+
+  if ((unsigned int) (arena->end - arena->ptr) < size) {
+    SGFArenaBlock *block;
+    unsigned int block_size = SGF_ARENA_MIN_BLOCK;
+
+    if (arena->blocks) {
+      block_size = 2 * arena->blocks->size;
+      if (block_size > SGF_ARENA_MAX_BLOCK)
+	block_size = SGF_ARENA_MAX_BLOCK;
+    }
+    if (block_size < size + SGF_ARENA_HEADER)
+      block_size = size + SGF_ARENA_HEADER;
+
+    block = malloc(block_size);
+    if (!block) {
+      fprintf(stderr, "sgfArenaAlloc: Out of memory!\n");
+      exit(EXIT_FAILURE);
+    }
+    block->next = arena->blocks;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->ptr = (char *) block + SGF_ARENA_HEADER;
+    arena->end = (char *) block + block_size;
+  }
+
+  pt = arena->ptr;
+  arena->ptr += size;
+  return pt;
+}
+
+char *
+sgfArenaStrdup(SGFArena *arena, const char *s)
+{
+  unsigned int size = strlen(s) + 1;
+  char *pt = sgfArenaAlloc(arena, size);
+
+  memcpy(pt, s, size);
+  return pt;
+}
+
+void
+sgfArenaFree(SGFArena *arena)
+{
+  SGFArenaBlock *block = arena->blocks;
+
+  while (block) {
+    SGFArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  sgfArenaInit(arena);
+}
+
+/*
+ * Move the blocks of other into arena, which releases them together
+ * with its own. Allocation goes on in the current block of arena.
+ */
+
+void
+sgfArenaMerge(SGFArena *arena, SGFArena *other)
+{
+  SGFArenaBlock **tail = &arena->blocks;
+
+  if (arena->blocks == NULL) {
+    *arena = *other;
+    sgfArenaInit(other);
+    return;
+  }
+  while (*tail)
+    tail = &(*tail)->next;
+  *tail = other->blocks;
+  sgfArenaInit(other);
+}
+
+
 /* ================================================================ */
 /*                           SGF Nodes                              */
 /* ================================================================ */
 
 
 /*
- * Allocate memory for a new SGF node.
+ * Allocate memory for a new SGF node, from the arena if one is given.
  */
 
-SGFNode *
-sgfNewNode()
+static SGFNode *
+new_node(SGFArena *arena)
 {
   SGFNode *newnode;
-  newnode = xalloc(sizeof(SGFNode));
+  if (arena)
+    newnode = sgfArenaAlloc(arena, sizeof(SGFNode));
+  else
+    newnode = xalloc(sizeof(SGFNode));
   newnode->next = NULL;
   newnode->props = NULL;
   newnode->parent = NULL;
@@ -116,22 +230,52 @@ sgfNewNode()
   newnode->nextVar = NULL;
   newnode->draw_lvl = -1;
   newnode->move_num = 0;
+  newnode->flags = 0;
+  newnode->unparsed = NULL;
   return newnode;
 }
 
+SGFNode *
+sgfNewNode()
+{
+  return new_node(NULL);
+}
+
 /*
- * Recursively free an sgf node
+ * Free an sgf node with its siblings and all their descendants.
+ * The tree is walked without recursion: the child chain is followed
+ * directly, and only pending siblings are kept on a stack, so its size
+ * is bounded by the nesting depth of the variations.
  */
 
 void
 sgfFreeNode(SGFNode *node)
 {
-  if (node == NULL)
-    return;
-  sgfFreeNode(node->next);
-  sgfFreeNode(node->child);
-  sgfFreeProperty(node->props);
-  free(node);
+  SGFNode **stack = NULL;
+  int depth = 0;
+  int size = 0;
+
+  while (node) {
+    SGFNode *child = node->child;
+
+    if (node->next) {
+      if (depth == size) {
+	size = size ? 2 * size : 64;
+	stack = xrealloc(stack, size * sizeof(SGFNode *));
+      }
+      stack[depth++] = node->next;
+    }
+    sgfFreeProperty(node->props);
+    free(node);
+
+    if (child)
+      node = child;
+    else if (depth > 0)
+      node = stack[--depth];
+    else
+      node = NULL;
+  }
+  free(stack);
 }
 
 
@@ -192,7 +336,10 @@ sgfGetIntProperty(SGFNode *node, const char *name, int *value)
 
   for (prop = node->props; prop; prop = prop->next)
     if (prop->name == nam) {
-      *value = atoi(prop->value);
+      if ((prop->flags & SGF_PROP_TYPE) == SGF_PROP_NUMBER)
+	*value = prop->data.number;
+      else
+	*value = atoi(prop->value);
       return 1;
     }
 
@@ -212,7 +359,10 @@ sgfGetFloatProperty(SGFNode *node, const char *name, float *value)
 
   for (prop = node->props; prop; prop = prop->next)
     if (prop->name == nam) {
-      *value = (float) atof(prop->value);
+      if ((prop->flags & SGF_PROP_TYPE) == SGF_PROP_REAL)
+	*value = prop->data.real;
+      else
+	*value = (float) atof(prop->value);
       /* MS-C warns of loss of data (double to float) */
       return 1;
     }
@@ -259,6 +409,169 @@ sgfHasProperty(SGFNode *node, const char *name)
 }
 
 
+/*
+ * Is the value a compressed point list which can be kept as a
+ * rectangle, with the corners in order and on a board of at most
+ * 26x26?
+ */
+
+static int
+is_rectangle(const char *value)
+{
+  return (value[0] >= 'a' && value[0] <= 'z'
+	  && value[1] >= 'a' && value[1] <= 'z'
+	  && value[2] == ':'
+	  && value[3] >= value[0] && value[3] <= 'z'
+	  && value[4] >= value[1] && value[4] <= 'z'
+	  && value[5] == '\0');
+}
+
+
+/*
+ * The index of a property name in sgf_property_table, 0 if it is not
+ * in the specification.
+ */
+
+int
+sgf_property_id(short name)
+{
+  unsigned int first = (name & 0xff) - 'A';
+  unsigned int second = ((unsigned short) name >> 8) - 'A';
+
+  if (first >= 26)
+    return 0;
+  if ((unsigned short) name >> 8 == ' ')
+    return sgf_property_ids[first * 27];
+  if (second >= 26)
+    return 0;
+  return sgf_property_ids[first * 27 + second + 1];
+}
+
+
+const SGFPropertyInfo *
+sgf_property_info(short name)
+{
+  return &sgf_property_table[sgf_property_id(name)];
+}
+
+
+/*
+ * Decode the value of a property of a known type into its data, see
+ * SGF_PROP_TYPE. Called whenever the value is set.
+ */
+
+static void
+decode_property(SGFProperty *prop)
+{
+  const SGFPropertyInfo *info = sgf_property_info(prop->name);
+  const char *value = prop->value;
+
+  prop->flags &= ~SGF_PROP_TYPE;
+  switch (info->value) {
+  case SGF_VALUE_POINT: case SGF_VALUE_STONE: case SGF_VALUE_MOVE:
+    if ((info->flags & SGF_PROPERTY_RANGE) && is_rectangle(value)) {
+      prop->flags |= SGF_PROP_RECT;
+      prop->data.rect.x1 = value[1] - 'a';
+      prop->data.rect.y1 = value[0] - 'a';
+      prop->data.rect.x2 = value[4] - 'a';
+      prop->data.rect.y2 = value[3] - 'a';
+      break;
+    }
+    prop->flags |= SGF_PROP_POINT;
+    if (value[0] == '\0' || value[1] == '\0') {
+      prop->data.point.x = -1;
+      prop->data.point.y = -1;
+    }
+    else {
+      prop->data.point.x = toupper((int) value[1]) - 'A';
+      prop->data.point.y = toupper((int) value[0]) - 'A';
+    }
+    break;
+
+  case SGF_VALUE_NUMBER: case SGF_VALUE_DOUBLE:
+    prop->flags |= SGF_PROP_NUMBER;
+    prop->data.number = atoi(value);
+    break;
+
+  case SGF_VALUE_REAL:
+    prop->flags |= SGF_PROP_REAL;
+    prop->data.real = (float) atof(value);
+    break;
+  }
+}
+
+
+/*
+ * Note a new property of node in its SGF_NODE_* flags. It must have
+ * been decoded already.
+ */
+
+static void
+flag_property(SGFNode *node, SGFProperty *prop)
+{
+  int flags = sgf_property_info(prop->name)->node_flags;
+
+  if (flags & SGF_NODE_MOVE) {
+    if (node->flags & SGF_NODE_MOVE)
+      return;
+    if (prop->data.point.x == -1 && prop->data.point.y == -1)
+      flags |= SGF_NODE_PASS;
+    else if (prop->data.point.x == 19 && prop->data.point.y == 19)
+      flags |= SGF_NODE_TT;
+  }
+  node->flags |= flags;
+}
+
+
+/*
+ * Compute the SGF_NODE_* flags of node again after a property changed.
+ */
+
+static void
+flag_node(SGFNode *node)
+{
+  SGFProperty *prop;
+
+  node->flags = 0;
+  for (prop = node->props; prop; prop = prop->next)
+    flag_property(node, prop);
+}
+
+
+/*
+ * Resize the value of a property. A borrowed value is copied into a
+ * freshly allocated one first, so that it can be modified. With an
+ * arena the new value is allocated from it, and is then borrowed as
+ * well: it is freed with the arena, like the other values of a tree
+ * read into one.
+ */
+
+static char *
+resize_property_value(SGFProperty *prop, unsigned int size, SGFArena *arena)
+{
+  if (arena) {
+    char *value = sgfArenaAlloc(arena, size);
+
+    strncpy(value, prop->value, size - 1);
+    if (!(prop->flags & SGF_PROP_BORROWED))
+      free(prop->value);
+    prop->value = value;
+    prop->flags |= SGF_PROP_BORROWED;
+  }
+  else if (prop->flags & SGF_PROP_BORROWED) {
+    char *value = xalloc(size);
+
+    strncpy(value, prop->value, size - 1);
+    prop->value = value;
+    prop->flags &= ~SGF_PROP_BORROWED;
+  }
+  else
+    prop->value = xrealloc(prop->value, size);
+
+  return prop->value;
+}
+
+
 /*
  * Overwrite a property from an SGF node with text or create a new
  * one if it does not exist.
@@ -266,18 +579,32 @@ sgfHasProperty(SGFNode *node, const char *name)
 
 void
 sgfOverwriteProperty(SGFNode *node, const char *name, const char *text)
+{
+  sgfArenaOverwriteProperty(node, name, text, NULL);
+}
+
+
+/*
+ * The same for a tree allocated from arena, see sgfArenaAddProperty().
+ */
+
+void
+sgfArenaOverwriteProperty(SGFNode *node, const char *name, const char *text,
+			  SGFArena *arena)
 {
   SGFProperty *prop;
   short nam = name[0] | name[1] << 8;
 
   for (prop = node->props; prop; prop = prop->next)
     if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, strlen(text)+1);
+      resize_property_value(prop, strlen(text)+1, arena);
       strcpy(prop->value, text);
+      decode_property(prop);
+      flag_node(node);
       return;
     }
 
-  sgfAddProperty(node, name, text);
+  sgfArenaAddProperty(node, name, text, arena);
 }
 
 
@@ -294,8 +621,10 @@ sgfOverwritePropertyInt(SGFNode *node, const char *name, int val)
 
   for (prop = node->props; prop; prop = prop->next)
     if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, 12);
+      resize_property_value(prop, 12, NULL);
       snprintf(prop->value, 12, "%d", val);
+      decode_property(prop);
+      flag_node(node);
       return;
    }
 
@@ -316,8 +645,10 @@ sgfOverwritePropertyFloat(SGFNode *node, const char *name, float val)
 
   for (prop = node->props; prop; prop = prop->next)
     if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, 15);
+      resize_property_value(prop, 15, NULL);
       snprintf(prop->value, 15, "%3.1f", val);
+      decode_property(prop);
+      flag_node(node);
       return;
     }
 
@@ -369,19 +700,40 @@ sgfRoot(SGFNode *node)
 
 
 /*
- * Make an SGF property.
+ * Make an SGF property. If borrow is set, the property points to
+ * value instead of holding a copy of it. If an arena is given, the
+ * property and the copy of its value are allocated from it.
  */
 static SGFProperty *
 do_sgf_make_property(short sgf_name,  const char *value,
-		     SGFNode *node, SGFProperty *last)
+		     SGFNode *node, SGFProperty *last,
+		     SGFArena *arena, int borrow)
 {
   SGFProperty *prop;
 
-  prop = (SGFProperty *) xalloc(sizeof(SGFProperty));
+  if (arena) {
+    prop = (SGFProperty *) sgfArenaAlloc(arena, sizeof(SGFProperty));
+    prop->flags = SGF_PROP_BORROWED;
+    if (borrow)
+      prop->value = (char *) value;
+    else
+      prop->value = sgfArenaStrdup(arena, value);
+  }
+  else {
+    prop = (SGFProperty *) xalloc(sizeof(SGFProperty));
+    if (borrow) {
+      prop->value = (char *) value;
+      prop->flags = SGF_PROP_BORROWED;
+    }
+    else {
+      prop->value = xalloc(strlen(value) + 1);
+      strcpy(prop->value, value);
+    }
+  }
   prop->name = sgf_name;
-  prop->value = xalloc(strlen(value) + 1);
-  strcpy(prop->value, value);
   prop->next = NULL;
+  decode_property(prop);
+  flag_property(node, prop);
 
   if (last == NULL)
     node->props = prop;
@@ -392,28 +744,15 @@ do_sgf_make_property(short sgf_name,  const char *value,
 }
 
 
-/* Make an SGF property.  In case of a property with a range it
- * expands it and makes several properties instead.
+/* Make an SGF property.  A range of points is kept as a single
+ * rectangle property, see SGF_PROP_RECT. Other ranges, which do not
+ * fit into one, are expanded into several properties. The expanded
+ * points are always copied, everything else is borrowed if requested.
  */
-SGFProperty *
-sgfMkProperty(const char *name, const  char *value,
-	      SGFNode *node, SGFProperty *last)
+static SGFProperty *
+mk_property(const char *name, const  char *value,
+	    SGFNode *node, SGFProperty *last, SGFArena *arena, int borrow)
 {
-  static const short properties_allowing_ranges[12] = {
-    /* Board setup properties. */
-    SGFAB, SGFAW, SGFAE,
-
-    /* Markup properties. */
-    SGFCR, SGFMA, SGFSQ, SGFTR, SGFDD, SGFSL,
-
-    /* Miscellaneous properties. */
-    SGFVW,
-
-    /* Go-specific properties. */
-    SGFTB, SGFTW
-  };
-
-  int k;
   short sgf_name;
 
   if (strlen(name) == 1)
@@ -421,14 +760,10 @@ sgfMkProperty(const char *name, const  char *value,
   else
     sgf_name = name[0] | name[1] << 8;
 
-  for (k = 0; k < 12; k++) {
-    if (properties_allowing_ranges[k] == sgf_name)
-      break;
-  }
-
-  if (k < 12
+  if ((sgf_property_info(sgf_name)->flags & SGF_PROPERTY_RANGE)
       && strlen(value) == 5
-      && value[2] == ':') {
+      && value[2] == ':'
+      && !is_rectangle(value)) {
     char x1 = value[0];
     char y1 = value[1];
     char x2 = value[3];
@@ -438,7 +773,8 @@ sgfMkProperty(const char *name, const  char *value,
     if (x1 <= x2 && y1 <= y2) {
       for (new_value[0] = x1; new_value[0] <= x2; new_value[0]++) {
 	for (new_value[1] = y1; new_value[1] <= y2; new_value[1]++)
-	  last = do_sgf_make_property(sgf_name, new_value, node, last);
+	  last = do_sgf_make_property(sgf_name, new_value, node, last,
+				      arena, 0);
       }
 
       return last;
@@ -446,23 +782,32 @@ sgfMkProperty(const char *name, const  char *value,
   }
 
   /* Not a range property. */
-  return do_sgf_make_property(sgf_name, value, node, last);
+  return do_sgf_make_property(sgf_name, value, node, last, arena, borrow);
+}
+
+
+SGFProperty *
+sgfMkProperty(const char *name, const  char *value,
+	      SGFNode *node, SGFProperty *last)
+{
+  return mk_property(name, value, node, last, NULL, 0);
 }
 
 
 /*
- * Recursively free an SGF property.
- *
+ * Free an SGF property and all properties following it.
  */
 
 void
 sgfFreeProperty(SGFProperty *prop)
 {
-  if (prop == NULL)
-    return;
-  sgfFreeProperty(prop->next);
-  free(prop->value);
-  free(prop);
+  while (prop) {
+    SGFProperty *next = prop->next;
+    if (!(prop->flags & SGF_PROP_BORROWED))
+      free(prop->value);
+    free(prop);
+    prop = next;
+  }
 }
 
 
@@ -776,12 +1121,92 @@ sgfAddChild(SGFNode *node)
 }
 
 
+/*
+ * Variants of sgfAddProperty(), sgfAddChild() and sgfAddComment() for
+ * trees allocated from an arena, see the annotation journal in
+ * sgftree.c. With arena NULL they allocate on the heap.
+ */
+
+SGFProperty *
+sgfArenaAddProperty(SGFNode *node, const char *name, const char *value,
+		    SGFArena *arena)
+{
+  SGFProperty *prop = node->props;
+
+  if (prop)
+    while (prop->next)
+      prop = prop->next;
+
+  return mk_property(name, value, node, prop, arena, 0);
+}
+
+
+SGFNode *
+sgfArenaAddChild(SGFNode *node, SGFArena *arena)
+{
+  SGFNode *new = new_node(arena);
+  SGFNode **link;
+
+  new->parent = node;
+  for (link = &node->child; *link; link = &(*link)->next)
+    ;
+  *link = new;
+
+  return new;
+}
+
+
+/*
+ * Add text to the comment of a node, on a new line if there is one
+ * already.
+ */
+
+void
+sgfArenaAddComment(SGFNode *node, const char *text, SGFArena *arena)
+{
+  SGFProperty *prop;
+  char *value;
+  size_t size;
+
+  for (prop = node->props; prop; prop = prop->next)
+    if (prop->name == SGFC)
+      break;
+  if (prop == NULL) {
+    sgfArenaAddProperty(node, "C", text, arena);
+    return;
+  }
+
+  size = strlen(prop->value) + strlen(text) + 2;
+  value = arena ? sgfArenaAlloc(arena, size) : xalloc(size);
+  snprintf(value, size, "%s\n%s", prop->value, text);
+  if (!(prop->flags & SGF_PROP_BORROWED))
+    free(prop->value);
+  if (arena)
+    prop->flags |= SGF_PROP_BORROWED;
+  else
+    prop->flags &= ~SGF_PROP_BORROWED;
+  prop->value = value;
+}
+
+
 /*
  * Write result of the game to the game tree.
  */
 
 void
 sgfWriteResult(SGFNode *node, float score, int overwrite)
+{
+  sgfArenaWriteResult(node, score, overwrite, NULL);
+}
+
+
+/*
+ * The same for a tree allocated from arena.
+ */
+
+void
+sgfArenaWriteResult(SGFNode *node, float score, int overwrite,
+		    SGFArena *arena)
 {
   char text[8];
   char winner;
@@ -816,7 +1241,7 @@ sgfWriteResult(SGFNode *node, float score, int overwrite)
     snprintf(text, 8, "%c+%3.1f", winner, s);
   else
     snprintf(text, 8, "%c+%c", winner, 'R');
-  sgfOverwriteProperty(node, "RE", text);
+  sgfArenaOverwriteProperty(node, "RE", text, arena);
 }
 
 
@@ -824,12 +1249,13 @@ static void
 sgf_write_header_reduced(SGFNode *root, int overwrite)
 {
   time_t curtime = time(NULL);
-  struct tm *loctime = localtime(&curtime);
+  struct tm loctime;
   char str[128];
   int dummy;
 
+  localtime_r(&curtime, &loctime);
   snprintf(str, 128, "%4.4i-%2.2i-%2.2i",
-	      loctime->tm_year+1900, loctime->tm_mon+1, loctime->tm_mday);
+	      loctime.tm_year+1900, loctime.tm_mon+1, loctime.tm_mday);
   if (overwrite || !sgfGetIntProperty(root, "DT", &dummy))
     sgfOverwriteProperty(root, "DT", str);
   if (overwrite || !sgfGetIntProperty(root, "AP", &dummy))
@@ -863,8 +1289,6 @@ sgf_write_header(SGFNode *root, int overwrite, int seed, float komi,
 /* ================================================================ */
 
 
-#define MAX_FILE_BUFFER 200000 /* buffer for reading SGF file. */
-
 /*
  * SGF grammar:
  *
@@ -885,31 +1309,48 @@ sgf_write_header(SGFNode *root, int overwrite, int seed, float komi,
  *   2) The only recursion is on gametree.
  *   3) Tokens are only one character
  * 
- * We will use a global state to keep track of the remaining input
- * and a global char variable, `lookahead' to hold the next token.  
- * The function `nexttoken' skips whitespace and fills lookahead with 
- * the new token.
+ * We keep the remaining input and a char variable, `lookahead', which
+ * holds the next token, in an SGFParser which is passed to every
+ * parsing function, so that several files can be parsed at the same
+ * time. The function `nexttoken' skips whitespace and fills lookahead
+ * with the new token. A parse error is recorded in the SGFParser and
+ * returns directly to sgfparser_stream().
+ *
+ * The parser does not build a tree itself but reports what it finds to
+ * an SGFHandler. The tree builder below is one such consumer; other
+ * code can look at a file without allocating any nodes.
+ *
+ * The input is the whole file in a writable buffer (usually a private
+ * memory mapping, see sgf_loadfile()). Property values are scanned
+ * directly in that buffer, unescaped and NUL terminated in place, so
+ * the tree can point into it instead of copying every value.
+ *
+ * A compressed file is not inflated as a whole but read from an
+ * SGFStream into a buffer of SGF_STREAM_CHUNK bytes, which is refilled
+ * whenever the parser reaches its end. Values may then cross the end
+ * of the buffer; they are collected in parser->value instead, and the
+ * tree gets copies.
+ *
+ * Text in another charset than UTF-8, declared by CA in the root node,
+ * is converted to UTF-8 as the values are read, so that the tree only
+ * holds UTF-8. A converted value is longer than the original and cannot
+ * stay in the buffer: it is copied into the arena, or otherwise handed
+ * out in parser->text.
  */
 
 
-static void parse_error(const char *msg, int arg);
-static void nexttoken(void);
-static void match(int expected);
-
-
-static FILE *sgffile;
-
-
-#define sgf_getch() (getc(sgffile))
+static void parse_error(SGFParser *parser, const char *msg, int arg);
+static int refill(SGFParser *parser);
+static void nexttoken(SGFParser *parser);
+static void match(SGFParser *parser, int expected);
+static const char *skip_value(const char *p, const char *end);
 
 
-static char *sgferr;
-#ifdef TEST_SGFPARSER
-static int sgferrarg;
-#endif
-static int sgferrpos;
+#define SGF_STREAM_CHUNK 65536
 
-static int lookahead;
+#define sgf_getch(parser) \
+  ((parser)->ptr < (parser)->end || refill(parser) \
+   ? (unsigned char) *(parser)->ptr++ : EOF)
 
 
 /* ---------------------------------------------------------------- */
@@ -917,31 +1358,66 @@ static int lookahead;
 /* ---------------------------------------------------------------- */
 
 
+/*
+ * Record the error and abandon the parse: return to sgfparser_stream().
+ */
+
 static void
-parse_error(const char *msg, int arg)
+parse_error(SGFParser *parser, const char *msg, int arg)
+{
+  parser->error = msg;
+  parser->errorarg = arg;
+  parser->errorpos = parser->offset + (parser->ptr - parser->buffer);
+  longjmp(parser->abort, 1);
+}
+
+
+/*
+ * Read the next chunk of a stream into the buffer, which is allocated
+ * on the first call. Returns 0 at the end of the input, and always for
+ * a complete buffer.
+ */
+
+static int
+refill(SGFParser *parser)
 {
-  fprintf(stderr, msg, arg);
-  fprintf(stderr, "\n");
-  exit(EXIT_FAILURE);
+  int n;
+
+  if (parser->stream == NULL)
+    return 0;
+
+  if (parser->buffer == NULL)
+    parser->buffer = xalloc(SGF_STREAM_CHUNK);
+  else
+    parser->offset += parser->end - parser->buffer;
+  parser->ptr = parser->end = parser->buffer;
+
+  n = parser->stream->read(parser->stream->source, parser->buffer,
+			   SGF_STREAM_CHUNK);
+  if (n < 0)
+    parse_error(parser, "Read error", 0);
+  parser->end += n;
+  return n > 0;
 }
 
 
 static void
-nexttoken()
+nexttoken(SGFParser *parser)
 {
   do
-    lookahead = sgf_getch();
-  while (isspace(lookahead));
+    parser->ptr = (char *) sgf_skip_space(parser->ptr, parser->end);
+  while (parser->ptr == parser->end && refill(parser));
+  parser->lookahead = sgf_getch(parser);
 }
 
 
 static void
-match(int expected)
+match(SGFParser *parser, int expected)
 {
-  if (lookahead != expected)
-    parse_error("expected: %c", expected);
+  if (parser->lookahead != expected)
+    parse_error(parser, "expected: %c", expected);
   else
-    nexttoken();
+    nexttoken(parser);
 }
 
 /* ---------------------------------------------------------------- */
@@ -950,225 +1426,1145 @@ match(int expected)
 
 
 static void
-propident(char *buffer, int size)
+propident(SGFParser *parser, char *buffer, int size)
 {
-  if (lookahead == EOF || !isupper(lookahead)) 
-    parse_error("Expected an upper case letter.", 0);
+  if (parser->lookahead == EOF || !isupper(parser->lookahead)) 
+    parse_error(parser, "Expected an upper case letter.", 0);
   
-  while (lookahead != EOF && isalpha(lookahead)) {
-    if (isupper(lookahead) && size > 1) {
-      *buffer++ = lookahead;
+  while (parser->lookahead != EOF && isalpha(parser->lookahead)) {
+    if (isupper(parser->lookahead) && size > 1) {
+      *buffer++ = parser->lookahead;
       size--;
     }
-    nexttoken();
+    nexttoken(parser);
   }
   *buffer = '\0';
 }
 
 
+/*
+ * Append len bytes to the value collected from a stream.
+ */
+
 static void
-propvalue(char *buffer, int size)
-{
-  char *p = buffer;
-
-  match('[');
-  while (lookahead != ']' && lookahead != EOF) {
-    if (lookahead == '\\') {
-      lookahead = sgf_getch();
-      /* Follow the FF4 definition of backslash */
-      if (lookahead == '\r') {
-	lookahead = sgf_getch();
-	if (lookahead == '\n') 
-	  lookahead = sgf_getch();
-      }
-      else if (lookahead == '\n') {
-	lookahead = sgf_getch();
-	if (lookahead == '\r') 
-	  lookahead = sgf_getch();
-      }
-    }
-    if (size > 1) {
-      *p++ = lookahead;
-      size--;
-    }
-    lookahead = sgf_getch();
+value_append(SGFParser *parser, size_t *pos, const char *s, size_t len)
+{
+  if (*pos + len >= parser->valuesize) {
+    while (*pos + len >= parser->valuesize)
+      parser->valuesize = parser->valuesize ? 2 * parser->valuesize : 256;
+    parser->value = xrealloc(parser->value, parser->valuesize);
   }
-  match(']');
-  
-  /* Remove trailing whitespace. The double cast below is needed
-   * because "char" may be represented as a signed char, in which case
-   * characters between 128 and 255 would be negative and a direct
-   * cast to int would cause a negative value to be passed to isspace,
-   * possibly causing an assertion failure.
+  memcpy(parser->value + *pos, s, len);
+  *pos += len;
+}
+
+
+/*
+ * Read a property value from a stream, like propvalue() but into
+ * parser->value, since the value may continue in the next chunk.
+ */
+
+static char *
+stream_value(SGFParser *parser)
+{
+  size_t len = 0;
+  char c;
+  int ch;
+
+  /* Leading whitespace is skipped, like between tokens. */
+  do
+    parser->ptr = (char *) sgf_skip_space(parser->ptr, parser->end);
+  while (parser->ptr == parser->end && refill(parser));
+
+  for (;;) {
+    char *special = (char *) sgf_scan_special(parser->ptr, parser->end);
+
+    value_append(parser, &len, parser->ptr, special - parser->ptr);
+    parser->ptr = special;
+    if (special == parser->end) {
+      if (!refill(parser))
+	break;
+      continue;
+    }
+    if (*special == ']')
+      break;
+
+    /* A backslash, see propvalue(). */
+    parser->ptr++;
+    ch = sgf_getch(parser);
+    if (ch == '\r' || ch == '\n') {
+      int next = sgf_getch(parser);
+      if (next == (ch == '\r' ? '\n' : '\r'))
+	next = sgf_getch(parser);
+      ch = next;
+    }
+    if (ch == EOF)
+      break;
+    c = ch;
+    value_append(parser, &len, &c, 1);
+  }
+
+  parser->lookahead = sgf_getch(parser);
+  match(parser, ']');
+
+  /* Remove trailing whitespace, the first character is kept. */
+  while (len > 1 && isspace((int) (unsigned char) parser->value[len - 1]))
+    --len;
+  value_append(parser, &len, "", 1);
+
+  return parser->value;
+}
+
+
+/*
+ * Read a property value. The value is unescaped and NUL terminated
+ * in place, the returned string points into the input buffer.
+ */
+
+static char *
+propvalue(SGFParser *parser)
+{
+  char *ptr = parser->ptr;
+  char *end = parser->end;
+  char *value;
+  char *p;
+
+  if (parser->lookahead != '[')
+    parse_error(parser, "expected: %c", '[');
+
+  if (parser->stream)
+    return stream_value(parser);
+
+  /* Leading whitespace is skipped, like between tokens. */
+  ptr = (char *) sgf_skip_space(ptr, end);
+
+  /* Runs of plain characters are found a block at a time. They only
+   * need to be moved once an escape has been removed before them. */
+  value = p = ptr;
+  for (;;) {
+    char *special = (char *) sgf_scan_special(ptr, end);
+    if (p != ptr)
+      memmove(p, ptr, special - ptr);
+    p += special - ptr;
+    ptr = special;
+
+    if (ptr == end || *ptr == ']')
+      break;
+
+    /* A backslash. Follow the FF4 definition: a soft linebreak is
+     * removed and the character following it is taken literally.
+     */
+    ptr++;
+    if (ptr < end && (*ptr == '\r' || *ptr == '\n')) {
+      char c = *ptr++;
+      if (ptr < end && *ptr == (c == '\r' ? '\n' : '\r'))
+	ptr++;
+    }
+    if (ptr == end)
+      break;
+    *p++ = *ptr++;
+  }
+  parser->ptr = ptr;
+
+  parser->lookahead = sgf_getch(parser);
+  match(parser, ']');
+  
+  /* Remove trailing whitespace. The double cast below is needed
+   * because "char" may be represented as a signed char, in which case
+   * characters between 128 and 255 would be negative and a direct
+   * cast to int would cause a negative value to be passed to isspace,
+   * possibly causing an assertion failure. The first character is
+   * always kept.
    */
-  --p;
-  while (p > buffer && isspace((int) (unsigned char) *p))
+  while (p > value + 1 && isspace((int) (unsigned char) p[-1]))
     --p;
-  *++p = '\0';
+  assert(p < parser->ptr);
+  *p = '\0';
+
+  return value;
 }
 
 
-static SGFProperty *
-property(SGFNode *n, SGFProperty *last)
+/*
+ * Convert a value to UTF-8 with the converter of the parser. Plain
+ * ASCII is the same in all charsets that are used for SGF files and
+ * is returned as it is. A byte which cannot be converted is replaced
+ * by '?'. The converted value lives as long as the arena, or without
+ * one until the next value is converted.
+ */
+
+static char *
+convert_value(SGFParser *parser, char *value)
+{
+  const unsigned char *p;
+  char *in = value;
+  char *out;
+  size_t inleft, outleft;
+
+  for (p = (const unsigned char *) value; *p && *p < 0x80; p++)
+    ;
+  if (*p == '\0')
+    return value;
+
+  /* a character takes at most 4 bytes in UTF-8, and at least 1 before */
+  inleft = strlen(value);
+  if (4 * inleft + 1 > parser->textsize) {
+    parser->textsize = 4 * inleft + 1;
+    parser->text = xrealloc(parser->text, parser->textsize);
+  }
+  out = parser->text;
+  outleft = parser->textsize - 1;
+
+  iconv(parser->charset, NULL, NULL, NULL, NULL);
+  while (inleft > 0
+	 && iconv(parser->charset, &in, &inleft, &out, &outleft) == (size_t) -1
+	 && errno != E2BIG) {
+    *out++ = '?';
+    outleft--;
+    in++;
+    inleft--;
+  }
+  *out = '\0';
+
+  if (parser->arena && !parser->stream)
+    return sgfArenaStrdup(parser->arena, parser->text);
+  return parser->text;
+}
+
+
+/*
+ * Find the charset declared by CA in the root node, whose ';' has just
+ * been read, without parsing it: the properties before CA are to be
+ * converted as well. Only the input at hand is searched, for a stream
+ * property() catches a CA further on. Returns 0 if there is none.
+ */
+
+static int
+find_charset(const char *p, const char *end, char *charset, int size)
+{
+  char name[2];
+  int len = 0;
+
+  for (; p < end; p++) {
+    if (*p == ';' || *p == '(' || *p == ')')
+      return 0;
+
+    if (*p == '[') {
+      const char *value = sgf_skip_space(p + 1, end);
+
+      if (len == 2 && name[0] == 'C' && name[1] == 'A') {
+	for (len = 0; value + len < end && value[len] != ']'; len++)
+	  ;
+	while (len > 0 && isspace((unsigned char) value[len - 1]))
+	  len--;
+	if (value + len == end || len >= size)
+	  return 0;
+	memcpy(charset, value, len);
+	charset[len] = '\0';
+	return 1;
+      }
+      p = skip_value(p + 1, end) - 1;
+      len = 0;
+    }
+    else if (isupper((unsigned char) *p)) {
+      if (len < 2)
+	name[len] = *p;
+      len++;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Convert the text of the following values from charset to UTF-8.
+ * GB2312 files often use characters beyond it, so its superset GB18030
+ * is used instead. Nothing is converted for UTF-8, or if the C library
+ * does not know the charset.
+ */
+
+static iconv_t
+open_charset(const char *charset)
+{
+  if (strcasecmp(charset, "UTF-8") == 0 || strcasecmp(charset, "UTF8") == 0)
+    return (iconv_t) -1;
+  if (strcasecmp(charset, "GB2312") == 0 || strcasecmp(charset, "GBK") == 0)
+    charset = "GB18030";
+  return iconv_open("UTF-8", charset);
+}
+
+
+void
+sgfparser_set_charset(SGFParser *parser, const char *charset)
+{
+  if (parser->charset != (iconv_t) -1)
+    iconv_close(parser->charset);
+  parser->charset = open_charset(charset);
+}
+
+
+/*
+ * Was the text of the game of root converted to UTF-8 when it was
+ * read? Its CA then no longer describes it.
+ */
+
+static int
+is_converted(SGFNode *root)
+{
+  char *charset;
+  iconv_t cd;
+
+  if (!sgfGetCharProperty(root, "CA", &charset))
+    return 0;
+  cd = open_charset(charset);
+  if (cd == (iconv_t) -1)
+    return 0;
+  iconv_close(cd);
+  return 1;
+}
+
+
+/*
+ * Set up the conversion for a new game, see find_charset().
+ */
+
+static void
+game_charset(SGFParser *parser)
+{
+  char charset[32];
+
+  if (find_charset(parser->ptr, parser->end, charset, sizeof(charset)))
+    sgfparser_set_charset(parser, charset);
+  else
+    sgfparser_set_charset(parser, "UTF-8");
+}
+
+
+/*
+ * Report an event to the handler of the parser. A callback returning
+ * nonzero stops the parse, see sgfparser_stream().
+ */
+
+#define emit(parser, event, args) \
+  do { \
+    if ((parser)->handler->event && (parser)->handler->event args) \
+      longjmp((parser)->abort, 2); \
+  } while (0)
+
+
+static void
+property(SGFParser *parser)
 {
   char name[3];
-  char buffer[4000];
 
-  propident(name, sizeof(name));
+  propident(parser, name, sizeof(name));
   do {
-    propvalue(buffer, sizeof(buffer));
-    last = sgfMkProperty(name, buffer, n, last);
-  } while (lookahead == '[');
-  return last;
+    char *value = propvalue(parser);
+
+    if (name[0] == 'C' && name[1] == 'A' && name[2] == '\0'
+	&& parser->charset == (iconv_t) -1 && parser->nodes == 1
+	&& !(parser->flags & SGF_READ_VARIATIONS))
+      sgfparser_set_charset(parser, value);
+    else if (parser->charset != (iconv_t) -1)
+      value = convert_value(parser, value);
+    emit(parser, property, (parser->data, name, value));
+  } while (parser->lookahead == '[');
 }
 
 
 static void
-node(SGFNode *n)
+node(SGFParser *parser)
 {
-  SGFProperty *last = NULL;
-  match(';');
-  while (lookahead != EOF && isupper(lookahead))
-    last = property(n, last);
+  match(parser, ';');
+  parser->nodes++;
+  emit(parser, node_begin, (parser->data));
+  while (parser->lookahead != EOF && isupper(parser->lookahead))
+    property(parser);
 }
 
 
-static SGFNode *
-sequence(SGFNode *n)
+static void
+sequence(SGFParser *parser)
 {
-  node(n);
-  while (lookahead == ';') {
-    SGFNode *new = sgfNewNode();
-    new->parent = n;
-    n->child = new;
-    n = new;
-    node(n);
+  node(parser);
+  while (parser->lookahead == ';')
+    node(parser);
+}
+
+
+/*
+ * Skip a property value, p points behind its '['. Returns the position
+ * behind the closing ']'.
+ */
+
+static const char *
+skip_value(const char *p, const char *end)
+{
+  for (;;) {
+    p = sgf_scan_special(p, end);
+    if (p == end)
+      return p;
+    if (*p == ']')
+      return p + 1;
+    p += (p + 1 < end) ? 2 : 1;
   }
-  return n;
 }
 
 
+/*
+ * Skip a list of gametrees without parsing them. Returns the position
+ * of the ')' closing the enclosing gametree, or end.
+ */
+
+static char *
+skip_gametrees(char *p, char *end)
+{
+  int depth = 0;
+
+  while (p < end) {
+    switch (*p) {
+    case '(':
+      depth++;
+      break;
+    case ')':
+      if (depth-- == 0)
+	return p;
+      break;
+    case '[':
+      p = (char *) skip_value(p + 1, end);
+      continue;
+    }
+    p++;
+  }
+  return end;
+}
+
+
+/*
+ * Lazy reading: report the remaining variations of the current
+ * gametree, which start at the '(' in the lookahead, as unparsed range
+ * and continue behind them.
+ */
+
 static void
-gametree(SGFNode **p, SGFNode *parent, int mode) 
+defer_variations(SGFParser *parser)
 {
-  if (mode == STRICT_SGF)
-    match('(');
-  else
-    for (;;) {
-      if (lookahead == EOF) {
-	parse_error("Empty file?", 0);
-	break;
-      }
-      if (lookahead == '(') {
-	while (lookahead == '(')
-	  nexttoken();
-	if (lookahead == ';')
+  char *start = parser->ptr - 1;
+  char *end = skip_gametrees(start, parser->end);
+
+  parser->ptr = end;
+  emit(parser, variations_skipped, (parser->data, start, end - start));
+  nexttoken(parser);
+}
+
+
+/*
+ * SGF_READ_ROOT: skip the rest of a game behind its root node, up to
+ * and including the ')' closing it, without parsing it. Unlike
+ * skip_gametrees() this reads through the chunks of a stream; the
+ * values are passed over a block at a time as in stream_value().
+ */
+
+static void
+skip_game(SGFParser *parser)
+{
+  int depth = 0;
+  int ch = parser->lookahead;
+
+  for (;;) {
+    if (ch == EOF)
+      parse_error(parser, "expected: %c", ')');
+    if (ch == '(')
+      depth++;
+    else if (ch == ')' && depth-- == 0)
+      break;
+    else if (ch == '[') {
+      for (;;) {
+	char *special = (char *) sgf_scan_special(parser->ptr, parser->end);
+
+	parser->ptr = special;
+	if (special == parser->end) {
+	  if (!refill(parser))
+	    break;
+	  continue;
+	}
+	parser->ptr++;
+	if (*special == ']' || sgf_getch(parser) == EOF)
 	  break;
       }
-      nexttoken();
     }
+    ch = sgf_getch(parser);
+  }
+  nexttoken(parser);
+}
 
-  /* The head is parsed */
-  {
-    SGFNode *head = sgfNewNode();
-    SGFNode *last;
 
-    head->parent = parent;
-    *p = head;
+/*
+ * Lax start of a game: skip anything up to the next "(;". Returns 0 if
+ * the input ends first.
+ */
 
-    last = sequence(head);
-    p = &last->child;
-    while (lookahead == '(') {
-      gametree(p, last, STRICT_SGF);
-      p = &((*p)->next);
+static int
+find_game(SGFParser *parser)
+{
+  for (;;) {
+    if (parser->lookahead == EOF)
+      return 0;
+    if (parser->lookahead == '(') {
+      while (parser->lookahead == '(')
+	nexttoken(parser);
+      if (parser->lookahead == ';')
+	return 1;
     }
-    if (mode == STRICT_SGF)
-      match(')');
+    nexttoken(parser);
   }
 }
 
 
 /*
- * Fuseki readers
- * Reads an SGF file for extract_fuseki in a compact way
+ * An open gametree: the number of its variations parsed so far.
+ */
+
+typedef struct SGFParseFrame_t {
+  int variations;
+} SGFParseFrame;
+
+
+/*
+ * Parse a gametree and all gametrees nested in it. In LAX_SGF mode
+ * the gametree is a game, which find_game() has opened already.
+ * Instead of recursing for every '(' the open gametrees are kept on a
+ * stack in the parser, so deeply nested files cannot overflow the C
+ * stack. The stack is released by sgfparser_stream(), also after a
+ * parse error.
  */
 
 static void
-gametreefuseki(SGFNode **p, SGFNode *parent, int mode, 
-	       int moves_per_game, int i)
+gametree(SGFParser *parser, int mode)
 {
-  if (mode == STRICT_SGF)
-    match('(');
-  else
+  if (mode == STRICT_SGF) {
+    match(parser, '(');
+    emit(parser, variation_push, (parser->data));
+  }
+  else {
+    game_charset(parser);
+    parser->nodes = 0;
+    emit(parser, game_begin, (parser->data));
+    if (parser->flags & SGF_READ_ROOT) {
+      /* game_end comes before the skip: a handler stopping the parse
+       * there leaves the rest of the game unread */
+      node(parser);
+      emit(parser, game_end, (parser->data));
+      skip_game(parser);
+      return;
+    }
+  }
+
+  parser->stackdepth = 0;
+  for (;;) {
+    SGFParseFrame *frame;
+
+    if (parser->stackdepth == parser->stacksize) {
+      parser->stacksize = parser->stacksize ? 2 * parser->stacksize : 64;
+      parser->stack = xrealloc(parser->stack,
+			       parser->stacksize * sizeof(SGFParseFrame));
+    }
+    frame = &parser->stack[parser->stackdepth++];
+    frame->variations = 0;
+    sequence(parser);
+
+    /* Close gametrees until one continues with a variation. In lazy
+     * mode only the first variation is parsed. */
     for (;;) {
-      if (lookahead == EOF) {
-	parse_error("Empty file?", 0);
+      if (parser->lookahead == '(' && (parser->flags & SGF_READ_LAZY)
+	  && frame->variations > 0)
+	defer_variations(parser);
+      if (parser->lookahead == '(')
 	break;
+      if (--parser->stackdepth == 0) {
+	if (mode == STRICT_SGF) {
+	  /* a bare sequence ends with the input */
+	  if (!(parser->flags & SGF_READ_SEQUENCE)
+	      || parser->lookahead != EOF)
+	    match(parser, ')');
+	  emit(parser, variation_pop, (parser->data));
+	}
+	else
+	  emit(parser, game_end, (parser->data));
+	return;
       }
-      if (lookahead == '(') {
-	while (lookahead == '(')
-	  nexttoken();
-	if (lookahead == ';')
-	  break;
+      match(parser, ')');
+      emit(parser, variation_pop, (parser->data));
+      frame = &parser->stack[parser->stackdepth - 1];
+    }
+
+    match(parser, '(');
+    frame->variations++;
+    emit(parser, variation_push, (parser->data));
+  }
+}
+
+
+/*
+ * Parse the buffer of the parser and report what is found to the
+ * handler, without building a tree: all games of the file, or with
+ * SGF_READ_VARIATIONS a list of gametrees. Returns 1 if the input was
+ * parsed completely or a callback stopped the parse, and 0 on a parse
+ * error, which is then described by parser->error, parser->errorarg
+ * and parser->errorpos.
+ */
+
+int
+sgfparser_stream(SGFParser *parser, const SGFHandler *handler, void *data)
+{
+  int result;
+
+  parser->handler = handler;
+  parser->data = data;
+
+  switch (setjmp(parser->abort)) {
+  case 0:
+    nexttoken(parser);
+    if (parser->flags & SGF_READ_VARIATIONS)
+      while (parser->lookahead == '(')
+	gametree(parser, STRICT_SGF);
+    else {
+      if (!find_game(parser))
+	parse_error(parser, "Empty file?", 0);
+      do
+	gametree(parser, LAX_SGF);
+      while (find_game(parser));
+    }
+    result = 1;
+    break;
+  case 1:
+    result = 0;			/* parse error */
+    break;
+  default:
+    result = 1;			/* stopped by a callback */
+    break;
+  }
+
+  free(parser->stack);
+  parser->stack = NULL;
+  parser->stackdepth = 0;
+  parser->stacksize = 0;
+  free(parser->value);
+  parser->value = NULL;
+  parser->valuesize = 0;
+  free(parser->text);
+  parser->text = NULL;
+  parser->textsize = 0;
+  sgfparser_set_charset(parser, "UTF-8");
+  if (parser->stream) {
+    parser->offset += parser->end - parser->buffer;
+    free(parser->buffer);
+    parser->buffer = parser->ptr = parser->end = NULL;
+  }
+  return result;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*                         Building trees                           */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * The tree builder is the consumer of the parser events behind
+ * sgfparser_read() and sgfExpandVariations(). It keeps the open
+ * gametrees on a stack of its own: the last node of the sequence,
+ * which is the parent of the variations, and the link where the next
+ * variation goes.
+ */
+
+typedef struct SGFBuildFrame_t {
+  SGFNode *last;
+  SGFNode **link;
+} SGFBuildFrame;
+
+typedef struct SGFBuilder_t {
+  SGFArena *arena;              /* NULL to build on the heap      */
+  SGFNode *root;                /* the first node built           */
+  SGFNode *parent;              /* parent of the next head node   */
+  SGFNode **link;               /* where the next head node goes  */
+  SGFNode *node;                /* current node, NULL at a head   */
+  SGFProperty *last;            /* last property of node          */
+  SGFBuildFrame *stack;         /* open gametrees                 */
+  int depth;
+  int size;
+  int borrow;                   /* values stay in the input       */
+  int skip;                     /* games to pass over first       */
+} SGFBuilder;
+
+
+static void
+builder_init(SGFBuilder *builder, SGFArena *arena, int borrow)
+{
+  builder->arena = arena;
+  builder->root = NULL;
+  builder->parent = NULL;
+  builder->link = &builder->root;
+  builder->node = NULL;
+  builder->last = NULL;
+  builder->stack = NULL;
+  builder->depth = 0;
+  builder->size = 0;
+  builder->borrow = borrow;
+  builder->skip = 0;
+}
+
+
+static void
+builder_push(SGFBuilder *builder, SGFNode *last, SGFNode **link)
+{
+  if (builder->depth == builder->size) {
+    builder->size = builder->size ? 2 * builder->size : 64;
+    builder->stack = xrealloc(builder->stack,
+			      builder->size * sizeof(SGFBuildFrame));
+  }
+  builder->stack[builder->depth].last = last;
+  builder->stack[builder->depth].link = link;
+  builder->depth++;
+}
+
+
+static int
+build_game_begin(void *data)
+{
+  SGFBuilder *builder = data;
+
+  if (builder->skip)
+    return 0;
+  builder->parent = NULL;
+  builder->link = &builder->root;
+  builder->node = NULL;
+  return 0;
+}
+
+
+/* Only the first game after the skipped ones is built. */
+
+static int
+build_game_end(void *data)
+{
+  SGFBuilder *builder = data;
+
+  if (builder->skip) {
+    builder->skip--;
+    return 0;
+  }
+  builder->depth--;
+  return 1;
+}
+
+
+static int
+build_node_begin(void *data)
+{
+  SGFBuilder *builder = data;
+  SGFNode *new;
+
+  if (builder->skip)
+    return 0;
+  new = new_node(builder->arena);
+  if (builder->node == NULL) {
+    /* The head is parsed */
+    new->parent = builder->parent;
+    *builder->link = new;
+    if (builder->depth > 0)
+      builder->stack[builder->depth - 1].link = &new->next;
+    builder_push(builder, new, &new->child);
+  }
+  else {
+    SGFBuildFrame *frame = &builder->stack[builder->depth - 1];
+
+    new->parent = builder->node;
+    builder->node->child = new;
+    frame->last = new;
+    frame->link = &new->child;
+  }
+  builder->node = new;
+  builder->last = NULL;
+  return 0;
+}
+
+
+static int
+build_property(void *data, const char *name, char *value)
+{
+  SGFBuilder *builder = data;
+
+  if (builder->skip)
+    return 0;
+  builder->last = mk_property(name, value, builder->node, builder->last,
+			      builder->arena, builder->borrow);
+  return 0;
+}
+
+
+static int
+build_variation_push(void *data)
+{
+  SGFBuilder *builder = data;
+  SGFBuildFrame *frame;
+
+  if (builder->skip)
+    return 0;
+  frame = &builder->stack[builder->depth - 1];
+  builder->parent = frame->last;
+  builder->link = frame->link;
+  builder->node = NULL;
+  return 0;
+}
+
+
+static int
+build_variation_pop(void *data)
+{
+  SGFBuilder *builder = data;
+
+  if (builder->skip)
+    return 0;
+  builder->depth--;
+  return 0;
+}
+
+
+static int
+build_variations_skipped(void *data, char *start, size_t length)
+{
+  SGFBuilder *builder = data;
+  SGFNode *node = builder->stack[builder->depth - 1].last;
+
+  node->unparsed = sgfArenaAlloc(builder->arena, sizeof(SGFRange));
+  node->unparsed->start = start;
+  node->unparsed->length = length;
+  return 0;
+}
+
+
+static const SGFHandler build_handler = {
+  build_game_begin,
+  build_game_end,
+  build_node_begin,
+  build_property,
+  build_variation_push,
+  build_variation_pop,
+  build_variations_skipped
+};
+
+
+/* ---------------------------------------------------------------- */
+/*                          Input buffer                            */
+/* ---------------------------------------------------------------- */
+
+
+/*
+ * Load a whole file for parsing. Regular files are mapped privately
+ * and writable: the parser modifies the buffer in place, and the
+ * copy-on-write mapping keeps these changes away from the file.
+ * Filename "-" reads stdin into an allocated buffer instead, as does
+ * anything else that cannot be mapped. Returns NULL if the file will
+ * not open.
+ */
+
+char *
+sgf_loadfile(const char *filename, size_t *size, int *mapped)
+{
+  char *buffer = NULL;
+  size_t len = 0;
+  size_t alloc = 0;
+  ssize_t n;
+  int fd;
+  struct stat st;
+
+  *mapped = 0;
+
+  if (strcmp(filename, "-") == 0)
+    fd = STDIN_FILENO;
+  else {
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+      return NULL;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      buffer = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+      if (buffer != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+	madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+#endif
+	close(fd);
+	*size = st.st_size;
+	*mapped = 1;
+	return buffer;
       }
-      nexttoken();
+      buffer = NULL;
     }
-  
-  /* The head is parsed */
-  {
-
-    SGFNode *head = sgfNewNode();
-    SGFNode *last;
-    head->parent = parent;
-    *p = head;
-    
-    last = sequence(head);
-    p = &last->child;
-    while (lookahead == '(') {
-      if (last->props 
-	  && (last->props->name == SGFB || last->props->name == SGFW))
-	i++;
-      /* break after number_of_moves moves in SGF file */
-      if (i >= moves_per_game) { 
-	last->child = NULL;
-	last->next = NULL;
-	break;
+  }
+
+  /* Not mappable: read it in chunks. */
+  do {
+    if (len == alloc) {
+      alloc = alloc ? 2 * alloc : 65536;
+      buffer = xrealloc(buffer, alloc);
+    }
+    n = read(fd, buffer + len, alloc - len);
+    if (n > 0)
+      len += n;
+  } while (n > 0);
+
+  if (fd != STDIN_FILENO)
+    close(fd);
+
+  if (n < 0) {
+    free(buffer);
+    return NULL;
+  }
+
+  *size = len;
+  return buffer;
+}
+
+
+/*
+ * Release a buffer returned by sgf_loadfile().
+ */
+
+void
+sgf_unloadfile(char *buffer, size_t size, int mapped)
+{
+  if (buffer == NULL)
+    return;
+
+  if (mapped)
+    munmap(buffer, size);
+  else
+    free(buffer);
+}
+
+
+/*
+ * Find the top-level game trees of a collection without parsing them:
+ * a single scan keeps track of the parenthesis depth, skipping over
+ * property values so that parentheses in comments are not counted.
+ * A '(' at depth zero only opens a game if a ';' follows, like the
+ * lax start of the parser. A game left open at the end of the buffer
+ * extends to its end, the parser reports the error when it is read.
+ *
+ * Returns the number of games found and stores their positions in
+ * an array in *games, which the caller must free.
+ */
+
+int
+sgf_index_games(const char *buffer, size_t size, SGFGame **games)
+{
+  const char *p = buffer;
+  const char *end = buffer + size;
+  const char *start = NULL;
+  SGFGame *list = NULL;
+  int num_games = 0;
+  int allocated = 0;
+  int depth = 0;
+
+  while (p < end) {
+    switch (*p++) {
+    case '(':
+      if (depth == 0) {
+	const char *q = p;
+	while (q < end && isspace((unsigned char) *q))
+	  q++;
+	if (q == end || *q != ';')
+	  break;
+	start = p - 1;
       }
-      else {
-	gametreefuseki(p, last, mode, moves_per_game, i);
-	p = &((*p)->next);
+      depth++;
+      break;
+
+    case ')':
+      if (depth == 0 || --depth > 0)
+	break;
+      if (num_games == allocated) {
+	allocated = allocated ? 2 * allocated : 16;
+	list = xrealloc(list, allocated * sizeof(SGFGame));
       }
+      list[num_games].offset = start - buffer;
+      list[num_games].length = p - start;
+      num_games++;
+      break;
+
+    case '[':
+      if (depth > 0)
+	p = skip_value(p, end);
+      break;
     }
-    if (mode == STRICT_SGF)
-      match(')');
   }
+
+  if (depth > 0) {
+    if (num_games == allocated)
+      list = xrealloc(list, (num_games + 1) * sizeof(SGFGame));
+    list[num_games].offset = start - buffer;
+    list[num_games].length = end - start;
+    num_games++;
+  }
+
+  *games = list;
+  return num_games;
+}
+
+
+/*
+ * Fuseki readers
+ * Reads an SGF file for extract_fuseki in a compact way: a variation is
+ * cut off, with all nested in it, once moves_per_game moves are counted
+ * on its branch. As in the recursive reader before, a move is counted
+ * for the last node of a sequence each time a variation follows it.
+ */
+
+typedef struct SGFFusekiBuilder_t {
+  SGFBuilder builder;
+  int moves_per_game;
+  int *moves;                   /* count of each open gametree    */
+  int size;
+  int cut;                      /* open gametrees being cut off   */
+} SGFFusekiBuilder;
+
+
+static int
+fuseki_game_begin(void *data)
+{
+  SGFFusekiBuilder *fuseki = data;
+
+  if (fuseki->size == 0) {
+    fuseki->size = 64;
+    fuseki->moves = xalloc(fuseki->size * sizeof(int));
+  }
+  fuseki->moves[0] = 0;
+  return build_game_begin(&fuseki->builder);
+}
+
+
+static int
+fuseki_node_begin(void *data)
+{
+  SGFFusekiBuilder *fuseki = data;
+
+  if (fuseki->cut)
+    return 0;
+  return build_node_begin(&fuseki->builder);
 }
 
+
+static int
+fuseki_property(void *data, const char *name, char *value)
+{
+  SGFFusekiBuilder *fuseki = data;
+
+  if (fuseki->cut)
+    return 0;
+  return build_property(&fuseki->builder, name, value);
+}
+
+
+static int
+fuseki_variation_push(void *data)
+{
+  SGFFusekiBuilder *fuseki = data;
+  SGFBuilder *builder = &fuseki->builder;
+  SGFNode *last;
+  int depth = builder->depth;
+
+  if (fuseki->cut) {
+    fuseki->cut++;
+    return 0;
+  }
+
+  last = builder->stack[depth - 1].last;
+  if (last->props 
+      && (last->props->name == SGFB || last->props->name == SGFW))
+    fuseki->moves[depth - 1]++;
+  /* break after number_of_moves moves in SGF file */
+  if (fuseki->moves[depth - 1] >= fuseki->moves_per_game) { 
+    /* this drops the variations built already as well; the count only
+     * grows, so none behind it is built either */
+    sgfFreeNode(last->child);
+    last->child = NULL;
+    fuseki->cut = 1;
+    return 0;
+  }
+
+  /* the count of the new gametree, whose frame goes at depth */
+  if (depth == fuseki->size) {
+    fuseki->size *= 2;
+    fuseki->moves = xrealloc(fuseki->moves, fuseki->size * sizeof(int));
+  }
+  fuseki->moves[depth] = fuseki->moves[depth - 1];
+  return build_variation_push(builder);
+}
+
+
+static int
+fuseki_variation_pop(void *data)
+{
+  SGFFusekiBuilder *fuseki = data;
+
+  if (fuseki->cut) {
+    fuseki->cut--;
+    return 0;
+  }
+  return build_variation_pop(&fuseki->builder);
+}
+
+
+static const SGFHandler fuseki_handler = {
+  fuseki_game_begin,
+  build_game_end,
+  fuseki_node_begin,
+  fuseki_property,
+  fuseki_variation_push,
+  fuseki_variation_pop,
+  NULL
+};
+
+
 SGFNode *
 readsgffilefuseki(const char *filename, int moves_per_game)
 {
+  SGFParser parser;
+  SGFFusekiBuilder fuseki;
   SGFNode *root;
   int tmpi = 0;
+  char *buffer;
+  size_t size;
+  int mapped;
 
-  if (strcmp(filename, "-") == 0)
-    sgffile = stdin;
-  else
-    sgffile = fopen(filename, "r");
-
-  if (!sgffile)
+  buffer = sgf_loadfile(filename, &size, &mapped);
+  if (!buffer)
     return NULL;
 
-
-  nexttoken();
-  gametreefuseki(&root, NULL, LAX_SGF, moves_per_game, 0);
-
-  fclose(sgffile);
-
-  if (sgferr) {
-    fprintf(stderr, "Parse error: %s at position %d\n", sgferr, sgferrpos);
-    sgfFreeNode(root);
+  builder_init(&fuseki.builder, NULL, 0);
+  fuseki.moves_per_game = moves_per_game;
+  fuseki.moves = NULL;
+  fuseki.size = 0;
+  fuseki.cut = 0;
+
+  sgfparser_init(&parser, buffer, size, NULL, 0);
+  if (!sgfparser_stream(&parser, &fuseki_handler, &fuseki)) {
+    fprintf(stderr, "Parse error: ");
+    fprintf(stderr, parser.error, parser.errorarg);
+    fprintf(stderr, " at position %ld\n", parser.errorpos);
+    free(fuseki.moves);
+    free(fuseki.builder.stack);
+    sgfFreeNode(fuseki.builder.root);
+    sgf_unloadfile(buffer, size, mapped);
     return NULL;
   }
+  free(fuseki.moves);
+  free(fuseki.builder.stack);
+  root = fuseki.builder.root;
+
+  sgf_unloadfile(buffer, size, mapped);
 
   /* perform some simple checks on the file */
   if (!sgfGetIntProperty(root, "GM", &tmpi)) {
@@ -1195,35 +2591,237 @@ readsgffilefuseki(const char *filename, int moves_per_game)
 
 
 /*
- * Wrapper around readsgf which reads from a file rather than a string.
- * Returns NULL if file will not open, or some other parsing error.
- * Filename "-" means read from stdin, and leave it open when done.
+ * Prepare a parser for a buffer returned by sgf_loadfile() holding a
+ * complete SGF file. The buffer is modified. If an arena is given, the
+ * tree is allocated from it and its property values point into the
+ * buffer, which must then be kept until the arena is freed. Otherwise
+ * the tree is allocated on the heap and owns copies of all values, and
+ * SGF_READ_LAZY in flags is ignored.
  */
 
-SGFNode *
-readsgffile(const char *filename)
+void
+sgfparser_init(SGFParser *parser, char *buffer, size_t size,
+	       SGFArena *arena, int flags)
+{
+  parser->buffer = buffer;
+  parser->ptr = buffer;
+  parser->end = buffer + size;
+  parser->stream = NULL;
+  parser->offset = 0;
+  parser->value = NULL;
+  parser->valuesize = 0;
+  parser->charset = (iconv_t) -1;
+  parser->text = NULL;
+  parser->textsize = 0;
+  parser->arena = arena;
+  parser->flags = arena ? flags : flags & ~SGF_READ_LAZY;
+  parser->lookahead = EOF;
+  parser->nodes = 0;
+  parser->handler = NULL;
+  parser->data = NULL;
+  parser->stack = NULL;
+  parser->stackdepth = 0;
+  parser->stacksize = 0;
+  parser->error = NULL;
+  parser->errorarg = 0;
+  parser->errorpos = 0;
+}
+
+
+/*
+ * Prepare a parser for reading from a stream. The tree gets copies of
+ * all property values, and SGF_READ_LAZY in flags is ignored since the
+ * input is not kept.
+ */
+
+void
+sgfparser_init_stream(SGFParser *parser, SGFStream *stream,
+		      SGFArena *arena, int flags)
 {
-    SGFNode *root;
-    int tmpi = 0;
+  sgfparser_init(parser, NULL, 0, arena, flags & ~SGF_READ_LAZY);
+  parser->stream = stream;
+}
 
-    if (strcmp(filename, "-") == 0)
-        sgffile = stdin;
-    else
-        sgffile = fopen(filename, "r");
 
-    if (!sgffile)
-        return NULL;
+/*
+ * droceRoG: determine the draw levels. The main line, ending with last
+ * at depth mainDepth, has level zero. The variations branching off the
+ * main line are laid out from the end of the game back to its start.
+ * Every node of such a variation goes one level above all nodes it is
+ * linked with by prevVar/nextVar, which are the nodes at the same depth.
+ * Since a newly laid out node is always the highest one at its depth,
+ * the highest level of every depth is all that needs to be known: each
+ * node is visited a constant number of times, and the extra memory is
+ * one int per depth.
+ */
+
+static void
+draw_levels(SGFNode *last, int mainDepth)
+{
+    SGFNode *curMove = NULL;
+    SGFNode *curVar = NULL;
+    SGFNode *i = NULL;
+    int *maxLvl = NULL;         /* highest level at each depth */
+    int size = 0;
+    int depth, d, lvl;
+
+    curMove = last;
+
+    /* go back in time */
+    for (depth=mainDepth; curMove; curMove=curMove->parent, depth--) {
+        for (curVar=curMove->next; curVar; curVar=curVar->next) {
+            lvl = 0;
+            for (i=curVar, d=depth; i; i=i->child, d++) {
+                int above = i->draw_lvl + 1;
+
+                if (i->prevVar || i->nextVar) {
+                    if (d >= size) {
+                        int k = size;
+
+                        size = 2 * d + 64;
+                        maxLvl = xrealloc(maxLvl, size * sizeof(int));
+                        /* the main line is the only laid out node yet */
+                        for (; k < size; k++)
+                            maxLvl[k] = k <= mainDepth ? 0 : -1;
+                    }
+                    above = maxLvl[d] + 1;
+                }
+                if (lvl < above)
+                    lvl = above;
 
+                i->draw_lvl = lvl;
+            }
+
+            /* go straight to maximum level without "stairs" */
+            for (i=curVar; i; i=i->child) {
+                /* check if maximum level is reached */
+                if (i->draw_lvl == lvl)
+                    break;
+
+                if (i->draw_lvl != i->parent->draw_lvl + 1)
+                    i->draw_lvl = i->parent->draw_lvl + 1;
+            }
+
+            for (i=curVar, d=depth; i; i=i->child, d++) {
+                if ((i->prevVar || i->nextVar) && maxLvl[d] < i->draw_lvl)
+                    maxLvl[d] = i->draw_lvl;
+            }
+        }
+    }
+
+    free(maxLvl);
+}
+
+
+/*
+ * droceRoG: compute the variation links, draw levels and move numbers
+ * of a freshly built tree. The nodes of each depth are linked into a
+ * list by the sweep line method, and get the move number of the main
+ * line node heading the list in the same step. This visits all linked
+ * nodes once; only the variations branching off the main line are
+ * visited again for their draw levels.
+ */
+
+static void
+link_tree(SGFNode *root)
+{
+    SGFNode *lst = root;
+    SGFNode *cur_i = NULL;
+    SGFNode *cur_end = NULL;
+    SGFNode *mainNode = root;   /* heads lst, NULL behind the main line */
+    SGFNode *last = root;       /* last node of the main line */
+    int mainDepth = 0;
+    int move = 0;
+
+    /* Assuming there is only one variation at the beginning! */
+    assert( root->next == NULL );
+
+    /* main variation has level of zero */
+    root->draw_lvl = 0;
+    if (is_move_node(root))
+        move += 1;
+    root->move_num = move;
+
+    /* while lst has elements */
+    while (lst) {
+        /* the next main line node heads the next list */
+        if (mainNode && mainNode->child) {
+            mainNode = mainNode->child;
+            mainNode->draw_lvl = 0;
+            if (is_move_node(mainNode))
+                move += 1;
+            last = mainNode;
+            mainDepth++;
+        }
+        else
+            mainNode = NULL;
+
+        /* next move for each element (and deleting) */
+        cur_i = lst;
+        lst = NULL; /* save beginning of list */
+        cur_end = NULL; /* current end of list */
+        for (; cur_i; cur_i=cur_i->nextVar) {
+            if (cur_i->child) { /* if child exists, add node to current lst */
+                if (lst == NULL) {
+                    lst = cur_i->child;
+                    cur_end = cur_i->child;
+                } else {
+                    cur_end->nextVar = cur_i->child;
+                    cur_end->nextVar->prevVar = cur_end;
+                    cur_end = cur_end->nextVar;
+                }
+                if (mainNode)
+                    cur_end->move_num = move;
+            }
+        }
+        /* check for variations in the new list */
+        if (lst) {
+            cur_i = lst->next;
+            while (cur_i) {
+                cur_end->nextVar = cur_i;
+                cur_i->prevVar = cur_end;
+                cur_end = cur_end->nextVar;
+                if (mainNode)
+                    cur_end->move_num = move;
+
+                cur_i = cur_i->next;
+            }
+        }
+    }
+
+    /* droceRoG: determine draw level */
+    draw_levels(last, mainDepth);
+}
 
-    nexttoken();
-    gametree(&root, NULL, LAX_SGF);
 
-    if (sgffile != stdin)
-        fclose(sgffile);
+/*
+ * Parse game number game of the input of the parser. Returns NULL on a
+ * parsing error, which is then described by parser->error,
+ * parser->errorarg and parser->errorpos.
+ */
+
+static SGFNode *
+read_game(SGFParser *parser, int game)
+{
+    SGFBuilder builder;
+    SGFNode *root;
+    int tmpi = 0;
 
-    if (sgferr) {
-        fprintf(stderr, "Parse error: %s at position %d\n", sgferr, sgferrpos);
-        sgfFreeNode(root);
+    builder_init(&builder, parser->arena,
+                 parser->arena != NULL && parser->stream == NULL);
+    builder.skip = game;
+    if (!sgfparser_stream(parser, &build_handler, &builder)) {
+        free(builder.stack);
+        if (!parser->arena)
+            sgfFreeNode(builder.root);
+        return NULL;
+    }
+    free(builder.stack);
+    root = builder.root;
+    if (root == NULL) {
+        parser->error = "No game %d in the file";
+        parser->errorarg = game;
+        parser->errorpos = parser->offset;
         return NULL;
     }
 
@@ -1244,114 +2842,240 @@ readsgffile(const char *filename)
     else if ((tmpi < 3 || tmpi > 4) && VERBOSE_WARNINGS)
         fprintf(stderr, "Unsupported SGF spec version: %d\n", tmpi);
 
-    /* droceRoG: build up variation links with sweep line method */
-    {
-        SGFNode *lst = root;
-        SGFNode *cur_i = NULL;
-        SGFNode *cur_end = NULL;
-        // SGFNode *var = NULL;
-
-        /* initialise lst by its next pointers from root SGFNode */
-        /* Assuming there is only one variation at the beginning! */
-        assert( root->next == NULL );
-
-        /* while lst has elements */
-        while (lst) {
-            /* next move for each element (and deleting) */
-            cur_i = lst;
-            lst = NULL; /* save beginning of list */
-            cur_end = NULL; /* current end of list */
-            for (; cur_i; cur_i=cur_i->nextVar) {
-                if (cur_i->child) { /* if child exists, add node to current lst */
-                    if (lst == NULL) {
-                        lst = cur_i->child;
-                        cur_end = cur_i->child;
-                    } else {
-                        cur_end->nextVar = cur_i->child;
-                        cur_end->nextVar->prevVar = cur_end;
-                        cur_end = cur_end->nextVar;
-                    }
-                }
-            }
-            /* check for variations in the new list */
-            if (lst) {
-                cur_i = lst->next;
-                while (cur_i) {
-                    cur_end->nextVar = cur_i;
-                    cur_i->prevVar = cur_end;
-                    cur_end = cur_end->nextVar;
+    link_tree(root);
 
-                    cur_i = cur_i->next;
-                }
-            }
-        }
+    return root;
+}
+
+
+/*
+ * Parse the (first) game tree of the input of the parser.
+ */
+
+SGFNode *
+sgfparser_read(SGFParser *parser)
+{
+    return read_game(parser, 0);
+}
+
+
+/*
+ * Parse a buffer returned by sgf_loadfile(), see sgfparser_init(). The
+ * game is parsed by several threads with SGF_READ_PARALLEL, see
+ * sgf_read_parallel(). Returns NULL on a parsing error.
+ */
+
+SGFNode *
+readsgfbuffer(char *buffer, size_t size, SGFArena *arena, int flags)
+{
+    SGFParser parser;
+    SGFNode *root;
+
+    if ((flags & SGF_READ_PARALLEL) && arena && !(flags & SGF_READ_LAZY))
+        return sgf_read_parallel(buffer, size, arena, 0);
+
+    sgfparser_init(&parser, buffer, size, arena, flags);
+    root = sgfparser_read(&parser);
+    if (!root) {
+        fprintf(stderr, "Parse error: ");
+        fprintf(stderr, parser.error, parser.errorarg);
+        fprintf(stderr, " at position %ld\n", parser.errorpos);
     }
-    // fprintf(stderr, "END while(lst)\n");
 
-    /* droceRoG: determine draw level */
-    {
-        SGFNode *curMove = NULL;
-        SGFNode *curVar = NULL;
-        SGFNode *i = NULL, *j = NULL;
-        int lvl = 0;
-
-        /* main variation has level of zero */
-        for (curMove=root; curMove; curMove=curMove->child) 
-            curMove->draw_lvl = 0;
-
-        /* get last element */
-        for (curMove=root; curMove->child; curMove=curMove->child) {}
-
-        /* go back in time */
-        for (; curMove; curMove=curMove->parent) {
-            curVar = curMove->next;
-            while (curVar) {
-                lvl = 0;
-                for (i=curVar; i; i=i->child) {
-                    for (j=i; j; j=j->prevVar) {
-                        if (lvl <= j->draw_lvl+1) 
-                            lvl = j->draw_lvl+1;
-                    }
-                    for (j=i; j; j=j->nextVar) {
-                        if (lvl <= j->draw_lvl+1) 
-                            lvl = j->draw_lvl+1;
-                    }
+    return root;
+}
 
-                    i->draw_lvl = lvl;
-                }
-                    
-                /* go straight to maximum level without "stairs" */
-                for (i=curVar; i; i=i->child) {
-                    /* check if maximum level is reached */
-                    if (i->draw_lvl == lvl)
-                        break;
-
-                    if (i->draw_lvl != i->parent->draw_lvl + 1)
-                        i->draw_lvl = i->parent->draw_lvl + 1;
-                }
 
-                curVar = curVar->next;
+/*
+ * Parse game number game (counting from 0) of a stream, see
+ * sgfparser_init_stream(). The games before it are parsed as well,
+ * but not built. Returns NULL on a parsing error.
+ */
+
+SGFNode *
+readsgfstream(SGFStream *stream, SGFArena *arena, int game)
+{
+    SGFParser parser;
+    SGFNode *root;
+
+    sgfparser_init_stream(&parser, stream, arena, 0);
+    root = read_game(&parser, game);
+    if (!root) {
+        fprintf(stderr, "Parse error: ");
+        fprintf(stderr, parser.error, parser.errorarg);
+        fprintf(stderr, " at position %ld\n", parser.errorpos);
+    }
+
+    return root;
+}
+
+
+/*
+ * Wrapper around readsgfbuffer which reads from a file.
+ * Returns NULL if file will not open, or some other parsing error.
+ * Filename "-" means read from stdin, and leave it open when done.
+ * A compressed file is read as a stream, see sgf_open_compressed().
+ */
+
+SGFNode *
+readsgffile(const char *filename)
+{
+    SGFNode *root;
+    char *buffer;
+    size_t size;
+    int mapped;
+
+    if (sgf_is_compressed(filename)) {
+        SGFStream stream;
+
+        if (!sgf_open_compressed(&stream, filename))
+            return NULL;
+        root = readsgfstream(&stream, NULL, 0);
+        stream.close(stream.source);
+        return root;
+    }
+
+    buffer = sgf_loadfile(filename, &size, &mapped);
+    if (!buffer)
+        return NULL;
+
+    root = readsgfbuffer(buffer, size, NULL, 0);
+
+    sgf_unloadfile(buffer, size, mapped);
+
+    return root;
+}
+
+
+/*
+ * Reset what link_tree() computed, so that it can run again after
+ * nodes were added. Not every node is reachable through the variation
+ * links, so the tree is walked like in sgfFreeNode().
+ */
+
+static void
+unlink_tree(SGFNode *root)
+{
+    SGFNode **stack = NULL;
+    int depth = 0;
+    int size = 0;
+    SGFNode *node = root;
+
+    while (node) {
+        node->prevVar = NULL;
+        node->nextVar = NULL;
+        node->draw_lvl = -1;
+        node->move_num = 0;
+
+        if (node->next) {
+            if (depth == size) {
+                size = size ? 2 * size : 64;
+                stack = xrealloc(stack, size * sizeof(SGFNode *));
             }
+            stack[depth++] = node->next;
         }
 
+        if (node->child)
+            node = node->child;
+        else if (depth > 0)
+            node = stack[--depth];
+        else
+            node = NULL;
     }
+    free(stack);
+}
 
-    /* determine move number */
-    {
-        SGFNode *curMove = NULL;
-        SGFNode *curVar = NULL;
-        int move = 0;
 
-        for (curMove=root; curMove; curMove=curMove->child) {
-            if (is_move_node(curMove))
-                move += 1;
+/*
+ * Lazy reading: parse the variations of node that were left unparsed
+ * by SGF_READ_LAZY, again lazily, without updating the variation links;
+ * sgfRelinkTree() does that once for all nodes expanded. The arena must
+ * be the one the tree was read into. Returns 1 if variations were
+ * added, 0 if there was nothing to parse or on a parse error.
+ */
 
-            for (curVar=curMove; curVar; curVar=curVar->nextVar)
-                curVar->move_num = move;
-        }
+int
+sgfParseUnparsed(SGFNode *node, SGFArena *arena)
+{
+    SGFRange *range = node->unparsed;
+    char *charset = NULL;
+
+    if (range == NULL)
+        return 0;
+    node->unparsed = NULL; /* try only once, also if it fails */
+
+    /* the text of the file is converted like when the root was read */
+    sgfGetCharProperty(sgfRoot(node), "CA", &charset);
+    return sgfParseVariations(node, range->start, range->length, arena,
+                              SGF_READ_LAZY, charset);
+}
+
+
+/*
+ * The same, and update the variation links of the whole tree.
+ */
+
+int
+sgfExpandVariations(SGFNode *node, SGFArena *arena)
+{
+    if (!sgfParseUnparsed(node, arena))
+        return 0;
+
+    sgfRelinkTree(sgfRoot(node));
+    return 1;
+}
+
+
+/*
+ * Parse a list of gametrees like an unparsed range, lazily if flags is
+ * SGF_READ_LAZY, or a single sequence with SGF_READ_SEQUENCE, and add
+ * them as the last children of node, with the text converted from
+ * charset unless it is NULL. The variation links are not updated.
+ * Returns 0 on a parse error, without adding any.
+ */
+
+int
+sgfParseVariations(SGFNode *node, char *start, size_t length,
+                   SGFArena *arena, int flags, const char *charset)
+{
+    SGFParser parser;
+    SGFBuilder builder;
+    SGFNode **first;
+
+    /* the variations follow the children there are */
+    for (first = &node->child; *first; first = &(*first)->next) {}
+
+    builder_init(&builder, arena, 1);
+    builder_push(&builder, node, first);
+    sgfparser_init(&parser, start, length, arena,
+                   flags | SGF_READ_VARIATIONS);
+    if (charset)
+        sgfparser_set_charset(&parser, charset);
+    if (!sgfparser_stream(&parser, &build_handler, &builder)) {
+        free(builder.stack);
+        if (!arena)
+            sgfFreeNode(*first);
+        *first = NULL;
+        fprintf(stderr, "Parse error: ");
+        fprintf(stderr, parser.error, parser.errorarg);
+        fprintf(stderr, " in variations at position %ld\n", parser.errorpos);
+        return 0;
     }
+    free(builder.stack);
+    return 1;
+}
 
-    return root;
+
+/*
+ * Compute the variation links, draw levels and move numbers again
+ * after nodes were added to the tree.
+ */
+
+void
+sgfRelinkTree(SGFNode *root)
+{
+    unlink_tree(root);
+    link_tree(root);
 }
 
 
@@ -1363,42 +3087,86 @@ readsgffile(const char *filename)
 
 #define OPTION_STRICT_FF4 0
 
-static int sgf_column = 0;
+#define SGF_WRITE_BUFFER 65536
+
+/*
+ * State of the SGF writer. The output is collected in a buffer and
+ * written a block at a time; column is the column of the output,
+ * error is set when writing fails.
+ */
+typedef struct SGFWriter_t {
+  FILE *file;
+  char *buffer;
+  size_t length;
+  int column;
+  int error;
+} SGFWriter;
+
+static void
+sgf_flush(SGFWriter *out)
+{
+  if (out->length > 0
+      && fwrite(out->buffer, 1, out->length, out->file) != out->length)
+    out->error = 1;
+  out->length = 0;
+}
+
+static void
+sgf_write(SGFWriter *out, const char *s, size_t n)
+{
+  while (n > 0) {
+    size_t chunk = SGF_WRITE_BUFFER - out->length;
+
+    if (chunk > n)
+      chunk = n;
+    memcpy(out->buffer + out->length, s, chunk);
+    out->length += chunk;
+    out->column += chunk;
+    s += chunk;
+    n -= chunk;
+    if (out->length == SGF_WRITE_BUFFER)
+      sgf_flush(out);
+  }
+}
 
 static void
-sgf_putc(int c, FILE *file)
+sgf_putc(int c, SGFWriter *out)
 {
-  if (c == '\n' && sgf_column == 0)
+  char ch = c;
+
+  if (c == '\n' && out->column == 0)
     return;
 
-  fputc(c, file);
+  sgf_write(out, &ch, 1);
 
   if (c == '\n')
-    sgf_column = 0;
-  else
-    sgf_column++;
+    out->column = 0;
 
-  if (c == ']' && sgf_column > 60) {
-    fputc('\n', file);
-    sgf_column = 0;
+  if (c == ']' && out->column > 60) {
+    sgf_write(out, "\n", 1);
+    out->column = 0;
   }
 }
 
+/* Write a value, escaping the characters that end or open one. */
 static void
-sgf_puts(const char *s, FILE *file)
+sgf_puts(const char *s, SGFWriter *out)
 {
-  for (; *s; s++) {
-    if (*s == '[' || *s == ']' || *s == '\\') {
-      fputc('\\', file);
-      sgf_column++;
-    }
-    fputc((int) *s, file);
-    sgf_column++;
+  for (;;) {
+    size_t n = strcspn(s, "[]\\");
+
+    sgf_write(out, s, n);
+    s += n;
+    if (*s == '\0')
+      return;
+    sgf_write(out, "\\", 1);
+    sgf_write(out, s++, 1);
   }
 }
 
-/* Print all properties with the given name in a node to file and mark
- * them as printed.
+/* Print all properties with the given name in a node to file. If
+ * value is not NULL, it is written instead of the first value, also if
+ * there is no property with the name.
  *
  * If is_comment is 1, multiple properties are concatenated with a
  * newline. I.e. we write
@@ -1414,71 +3182,94 @@ sgf_puts(const char *s, FILE *file)
  */
 
 static void
-sgf_print_name(FILE *file, short name)
+sgf_print_name(SGFWriter *out, short name)
 {
-  sgf_putc(name & 0xff, file);
+  sgf_putc(name & 0xff, out);
   if (name >> 8 != ' ')
-    sgf_putc(name >> 8, file);
+    sgf_putc(name >> 8, out);
 }
 
 static void
-sgf_print_property(FILE *file, SGFNode *node, short name, int is_comment)
+sgf_print_property(SGFWriter *out, SGFNode *node, short name, int is_comment,
+		   const char *value)
 {
   int n = 0;
   SGFProperty *prop;
 
+  if (value) {
+    sgf_print_name(out, name);
+    sgf_putc('[', out);
+    sgf_puts(value, out);
+    n++;
+  }
+
   for (prop = node->props; prop; prop = prop->next) {
     if (prop->name == name) {
-      prop->name |= 0x20;  /* Indicate already printed. */
+      if (value) {
+	value = NULL;		/* replaced */
+	continue;
+      }
       if (n == 0) {
-	sgf_print_name(file, name);
-	sgf_putc('[', file);
+	sgf_print_name(out, name);
+	sgf_putc('[', out);
       }
       else if (is_comment)
-	sgf_putc('\n', file);
+	sgf_putc('\n', out);
       else {
-	sgf_putc(']', file);
-	sgf_putc('[', file);
+	sgf_putc(']', out);
+	sgf_putc('[', out);
       }
       
-      sgf_puts(prop->value, file);
+      sgf_puts(prop->value, out);
       n++;
     }
   }
 
   if (n > 0)
-    sgf_putc(']', file);
+    sgf_putc(']', out);
 
   /* Add a newline after certain properties. */
-  if (name == SGFAB || name == SGFAW || name == SGFAE || (is_comment && n > 1))
-    sgf_putc('\n', file);
+  if ((sgf_property_info(name)->flags & (SGF_PROPERTY_SETUP | SGF_PROPERTY_LIST))
+      == (SGF_PROPERTY_SETUP | SGF_PROPERTY_LIST)
+      || (is_comment && n > 1))
+    sgf_putc('\n', out);
 }
 
 /*
- * Print all remaining unprinted property values at node N to file.
+ * Print the properties of node N which are not among the names printed
+ * before, in the order of their first values. Instead of marking the
+ * printed properties, a property is passed over if an earlier one has
+ * the same name, so the tree is not modified.
  */
 
 static void
-sgfPrintRemainingProperties(FILE *file, SGFNode *node)
+sgfPrintRemainingProperties(SGFWriter *out, SGFNode *node,
+			    const short *printed)
 {
-  SGFProperty *prop;
+  SGFProperty *prop, *p;
+  const short *name;
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (!(prop->name & 0x20))
-      sgf_print_property(file, node, prop->name, 0);
+  for (prop = node->props; prop; prop = prop->next) {
+    for (name = printed; *name && *name != prop->name; name++)
+      ;
+    if (*name)
+      continue;
+    for (p = node->props; p != prop && p->name != prop->name; p = p->next)
+      ;
+    if (p == prop)
+      sgf_print_property(out, node, prop->name, 0, NULL);
+  }
 }
 
 
 /*
- * Print the property values of NAME at node N and mark it as printed. 
+ * Print the property values of NAME at node N.
  */
 
 static void
-sgfPrintCharProperty(FILE *file, SGFNode *node, const char *name)
+sgfPrintCharProperty(SGFWriter *out, SGFNode *node, short name)
 {
-  short nam = name[0] | name[1] << 8;
-  
-  sgf_print_property(file, node, nam, 0);
+  sgf_print_property(out, node, name, 0, NULL);
 }
 
 
@@ -1490,157 +3281,253 @@ sgfPrintCharProperty(FILE *file, SGFNode *node, const char *name)
  */
 
 static void
-sgfPrintCommentProperty(FILE *file, SGFNode *node, const char *name)
+sgfPrintCommentProperty(SGFWriter *out, SGFNode *node, short name)
 {
-  short nam = name[0] | name[1] << 8;
-  
-  sgf_print_property(file, node, nam, 1);
+  sgf_print_property(out, node, name, 1, NULL);
 }
 
 
+/* The properties written first, in this order. */
+static const short node_names[] = { SGFB, SGFW, SGFN, SGFC, 0 };
+static const short root_names[] = {
+  SGFGM, SGFFF, SGFSZ, SGFGN, SGFDT, SGFPB, SGFBR, SGFPW, SGFWR, SGFCA, SGFN,
+  SGFC, 0
+};
+
+
 static void
-unparse_node(FILE *file, SGFNode *node)
+unparse_node(SGFWriter *out, SGFNode *node)
 {
-  sgf_putc(';', file);
-  sgfPrintCharProperty(file, node, "B ");
-  sgfPrintCharProperty(file, node, "W ");
-  sgfPrintCommentProperty(file, node, "N ");
-  sgfPrintCommentProperty(file, node, "C ");
-  sgfPrintRemainingProperties(file, node);
+  sgf_putc(';', out);
+  sgfPrintCharProperty(out, node, SGFB);
+  sgfPrintCharProperty(out, node, SGFW);
+  sgfPrintCommentProperty(out, node, SGFN);
+  sgfPrintCommentProperty(out, node, SGFC);
+  sgfPrintRemainingProperties(out, node, node_names);
 }
 
 
+/*
+ * The root gets the header that sgf_write_header_reduced() would add:
+ * FF[4], and DT and AP if they are missing. They are written without
+ * changing the tree.
+ */
+
 static void
-unparse_root(FILE *file, SGFNode *node)
+unparse_root(SGFWriter *out, SGFNode *node)
 {
-  sgf_putc(';', file);
-  
-  if (sgfHasProperty(node, "GM"))
-    sgfPrintCharProperty(file, node, "GM");
-  else {
-    fputs("GM[1]", file);
-    sgf_column += 5;
-  }
+  time_t curtime = time(NULL);
+  struct tm loctime;
+  char date[128];
+
+  /* not localtime(), the writer may run on several threads */
+  localtime_r(&curtime, &loctime);
+  snprintf(date, sizeof(date), "%4.4i-%2.2i-%2.2i",
+	   loctime.tm_year+1900, loctime.tm_mon+1, loctime.tm_mday);
+
+  sgf_putc(';', out);
   
-  sgfPrintCharProperty(file, node, "FF");
-  sgf_putc('\n', file);
+  sgf_print_property(out, node, SGFGM, 0,
+		     sgfHasProperty(node, "GM") ? NULL : "1");
+  sgf_print_property(out, node, SGFFF, 0, "4");
+  sgf_putc('\n', out);
 
-  sgfPrintCharProperty(file, node, "SZ");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(out, node, SGFSZ);
+  sgf_putc('\n', out);
   
-  sgfPrintCharProperty(file, node, "GN");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(out, node, SGFGN);
+  sgf_putc('\n', out);
   
-  sgfPrintCharProperty(file, node, "DT");
-  sgf_putc('\n', file);
+  sgf_print_property(out, node, SGFDT, 0,
+		     sgfHasProperty(node, "DT") ? NULL : date);
+  sgf_putc('\n', out);
   
-  sgfPrintCommentProperty(file, node, "PB");
-  sgfPrintCommentProperty(file, node, "BR");
-  sgf_putc('\n', file);
+  sgfPrintCommentProperty(out, node, SGFPB);
+  sgfPrintCommentProperty(out, node, SGFBR);
+  sgf_putc('\n', out);
   
-  sgfPrintCommentProperty(file, node, "PW");
-  sgfPrintCommentProperty(file, node, "WR");
-  sgf_putc('\n', file);
+  sgfPrintCommentProperty(out, node, SGFPW);
+  sgfPrintCommentProperty(out, node, SGFWR);
+  sgf_putc('\n', out);
   
-  sgfPrintCommentProperty(file, node, "N ");
-  sgfPrintCommentProperty(file, node, "C ");
-  sgfPrintRemainingProperties(file, node);
+  /* the text is written as it was read, converted to UTF-8 */
+  sgf_print_property(out, node, SGFCA, 0,
+		     is_converted(node) ? "UTF-8" : NULL);
 
-  sgf_putc('\n', file);
+  sgfPrintCommentProperty(out, node, SGFN);
+  sgfPrintCommentProperty(out, node, SGFC);
+  sgfPrintRemainingProperties(out, node, root_names);
+  if (!sgfHasProperty(node, "AP"))
+    sgf_print_property(out, node, SGFAP, 0, "GNU Go:"VERSION);
+
+  sgf_putc('\n', out);
 }
 
 
 /*
- * p->child is the next move.
- * p->next  is the next variation
+ * Write the variations of node left unparsed by lazy reading as their
+ * text, converted to UTF-8 with cd unless it is (iconv_t) -1. Bytes
+ * that cannot be converted are replaced by '?' as when parsing.
  */
 
 static void
-unparse_game(FILE *file, SGFNode *node, int root)
+unparse_range(SGFWriter *out, SGFNode *node, iconv_t cd)
 {
-  if (!root)
-    sgf_putc('\n', file);
-  sgf_putc('(', file);
-  if (root)
-    unparse_root(file, node);
-  else
-    unparse_node(file, node);
+  char text[1024];
+  char *in = node->unparsed->start;
+  size_t inleft = node->unparsed->length;
 
-  node = node->child;
-  while (node != NULL && node->next == NULL) {
-    unparse_node(file, node);
-    node = node->child;
-  } 
+  sgf_putc('\n', out);
+  if (cd == (iconv_t) -1) {
+    sgf_write(out, in, inleft);
+    return;
+  }
 
-  while (node != NULL) {
-    unparse_game(file, node, 0);
-    node = node->next;
+  iconv(cd, NULL, NULL, NULL, NULL);
+  while (inleft > 0) {
+    char *p = text;
+    size_t outleft = sizeof(text);
+    size_t n = iconv(cd, &in, &inleft, &p, &outleft);
+
+    sgf_write(out, text, p - text);
+    if (n == (size_t) -1 && errno != E2BIG) {
+      sgf_write(out, "?", 1);
+      in++;
+      inleft--;
+    }
   }
-  sgf_putc(')', file);
-  if (root)
-    sgf_putc('\n', file);
 }
 
-/* Printed properties are marked by adding the 0x20 bit to the
- * property name (changing an upper case letter to lower case). This
- * function removes this mark so that we can print the property next
- * time too. It recurses to all properties in the linked list.
+
+/*
+ * p->child is the next move.
+ * p->next  is the next variation
+ *
+ * The game is written in one pass over the tree. Instead of recursing
+ * for every variation, the variations being written are kept on a
+ * stack: when one is closed, the next one at its level follows.
+ *
+ * The variations of a lazily read tree which are not parsed yet follow
+ * the parsed ones as the text they were read from. The node then has
+ * variations also if only one is parsed.
  */
+
 static void
-restore_property(SGFProperty *prop)
-{
-  if (prop) {
-    restore_property(prop->next);
-    prop->name &= ~0x20;
+unparse_game(SGFWriter *out, SGFNode *root)
+{
+  SGFNode **stack = NULL;
+  int depth = 0;
+  int size = 0;
+  SGFNode *node = root;
+  iconv_t cd = (iconv_t) -1;
+  char *charset;
+
+  if (sgfGetCharProperty(root, "CA", &charset))
+    cd = open_charset(charset);
+
+  for (;;) {
+    /* open the variation starting at node and write its sequence */
+    if (node == root) {
+      sgf_putc('(', out);
+      unparse_root(out, node);
+    }
+    else {
+      sgf_putc('\n', out);
+      sgf_putc('(', out);
+      unparse_node(out, node);
+    }
+
+    node = node->child;
+    while (node != NULL && node->next == NULL && !node->parent->unparsed) {
+      unparse_node(out, node);
+      node = node->child;
+    } 
+
+    if (node != NULL) {
+      if (depth == size) {
+	size = size ? 2 * size : 64;
+	stack = xrealloc(stack, size * sizeof(SGFNode *));
+      }
+      stack[depth++] = node;
+      continue;
+    }
+
+    /* close variations until one has a sibling left */
+    for (;;) {
+      sgf_putc(')', out);
+      if (depth == 0) {
+	sgf_putc('\n', out);
+	if (cd != (iconv_t) -1)
+	  iconv_close(cd);
+	free(stack);
+	return;
+      }
+      node = stack[depth - 1]->next;
+      if (node != NULL) {
+	stack[depth - 1] = node;
+	break;
+      }
+      if (stack[depth - 1]->parent->unparsed)
+	unparse_range(out, stack[depth - 1]->parent, cd);
+      depth--;
+    }
   }
 }
 
-/* When called with the tree root, recurses to all properties in the
- * tree and removes all print marks.
+
+/*
+ * Write the game stored in the sgf structure to an open file. The tree
+ * is not modified. Returns 0 if writing fails.
  */
-static void
-restore_node(SGFNode *node)
+
+int
+fwritesgf(SGFNode *root, FILE *file)
 {
-  if (node) {
-    restore_property(node->props);
-    restore_node(node->child);
-    restore_node(node->next);
-  }
+  SGFWriter out;
+
+  out.file = file;
+  out.buffer = xalloc(SGF_WRITE_BUFFER);
+  out.length = 0;
+  out.column = 0;
+  out.error = 0;
+  unparse_game(&out, root);
+  sgf_flush(&out);
+  free(out.buffer);
+
+  return !out.error;
 }
 
 
 /*
  * Opens filename and writes the game stored in the sgf structure.
+ * Returns 0 if the file cannot be written.
  */
 
 int
 writesgf(SGFNode *root, const char *filename)
 {
-  FILE *outfile;
+  FILE *file;
+  int result;
 
   if (strcmp(filename, "-") == 0) 
-    outfile = stdout;
+    file = stdout;
   else
-    outfile = fopen(filename, "w");
+    file = fopen(filename, "w");
 
-  if (!outfile) {
+  if (!file) {
     fprintf(stderr, "Can not open %s\n", filename);
     return 0;
   }
 
-  sgf_write_header_reduced(root, 0);
-
-  sgf_column = 0;
-  unparse_game(outfile, root, 1);
-  if (outfile != stdout)
-    fclose(outfile);
-  
-  /* Remove "printed" marks so that the tree can be written multiple
-   * times.
-   */
-  restore_node(root);
+  result = fwritesgf(root, file);
+  if (file == stdout)
+    result &= fflush(stdout) == 0;
+  else
+    result &= fclose(file) == 0;
+  if (!result)
+    fprintf(stderr, "Can not write %s\n", filename);
   
-  return 1;
+  return result;
 }
 
 
@@ -1648,23 +3535,12 @@ writesgf(SGFNode *root, const char *filename)
 int
 main()
 {
-  static char buffer[25000];
-  static char output[25000];
   SGFNode *game;
 
-  sgffile = stdin;
-
-  nexttoken();
-  gametree(&game, LAX_SGF);
-  if (sgferr) {
-    fprintf(stderr, "Parse error:");
-    fprintf(stderr, sgferr, sgferrarg);
-    fprintf(stderr, " at position %d\n", sgferrpos);
-  }
-  else {
-    unparse_game(stdin, game, 1);
-    write(1, output, outputp - output);
-  }
+  game = readsgffile("-");
+  if (game)
+    writesgf(game, "-");
+  return game == NULL;
 }
 #endif
 
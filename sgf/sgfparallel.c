@@ -0,0 +1,348 @@
+/* droceRoG - parallel parsing of large games
+ *
+ * Opening trees merged from many games are single SGF files of tens of
+ * megabytes, nearly all of it in variations, which are independent
+ * once their text is known. A single scan matching the parentheses
+ * (and skipping property values) finds all gametrees of the game. The
+ * gametrees up to a small part of the game are parsed completely, the
+ * larger ones only up to their first variation: their sequences are
+ * parsed on their own (SGF_READ_SEQUENCE) and their variations in turn
+ * split in the same way. After the sequence of the root, which tells
+ * the charset of the text, all these pieces are parsed by a number of
+ * threads, the largest first, each into an arena of its own. Finally
+ * the pieces are linked as in the file, the arenas merged, and the
+ * variation links of the whole tree computed once.
+ *
+ * Only the scan runs on one processor. It is several times faster than
+ * parsing, which bounds how well the parse scales with more threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sgftree.h"
+
+/* gametrees larger than the game divided by this and the number of
+ * threads are split into their sequence and variations */
+#define SGF_PARALLEL_GRAIN 16
+
+/* How a gametree is parsed. */
+#define PIECE_NONE      0       /* as part of the gametree around it */
+#define PIECE_TREE      1       /* completely                        */
+#define PIECE_SEQUENCE  2       /* its sequence, variations on their own */
+
+/*
+ * A gametree of the game, with its first and last variation and the
+ * next one of its parent as indices.
+ */
+
+typedef struct SGFVariation_t {
+  char *start;                  /* the '('                        */
+  size_t length;                /* up to and including its ')'    */
+  int parent;
+  int child;
+  int last_child;
+  int next;
+  int piece;
+  SGFNode *first;               /* nodes parsed, the last one of  */
+  SGFNode *last;                /* a sequence only                */
+} SGFVariation;
+
+typedef struct SGFWork_t {
+  SGFVariation *vars;           /* in the order of the file       */
+  int num_vars;
+  int size_vars;
+  SGFVariation **order;         /* pieces for the workers,        */
+  int num_order;                /* largest first                  */
+  int next;                     /* next in order, under lock      */
+  int failed;
+  pthread_mutex_t lock;
+  const char *charset;
+} SGFWork;
+
+typedef struct SGFWorker_t {
+  SGFWork *work;
+  SGFArena arena;
+  pthread_t thread;
+} SGFWorker;
+
+
+/*
+ * Find the gametrees of the game in [p, end), which starts with its
+ * '('. Returns 0 if the text is not well formed, leaving it to the
+ * parser to report the error.
+ */
+
+static int
+index_variations(SGFWork *work, char *p, char *end)
+{
+  int cur = -1;
+
+  while (p < end) {
+    switch (*p) {
+    case '(': {
+      SGFVariation *var;
+      const char *q = sgf_skip_space(p + 1, end);
+
+      /* every gametree starts with a sequence */
+      if (q == end || *q != ';')
+	return 0;
+      if (work->num_vars == work->size_vars) {
+	work->size_vars = work->size_vars ? 2 * work->size_vars : 256;
+	work->vars = xrealloc(work->vars,
+			      work->size_vars * sizeof(SGFVariation));
+      }
+      var = &work->vars[work->num_vars];
+      memset(var, 0, sizeof(*var));
+      var->start = p;
+      var->parent = cur;
+      var->child = var->next = -1;
+      if (cur >= 0) {
+	if (work->vars[cur].child < 0)
+	  work->vars[cur].child = work->num_vars;
+	else
+	  work->vars[work->vars[cur].last_child].next = work->num_vars;
+	work->vars[cur].last_child = work->num_vars;
+      }
+      cur = work->num_vars++;
+      break;
+    }
+    case ')':
+      if (cur < 0)
+	return 0;
+      work->vars[cur].length = p + 1 - work->vars[cur].start;
+      cur = work->vars[cur].parent;
+      if (cur < 0)
+	return 1;
+      break;
+    case '[':
+      for (;;) {
+	p = (char *) sgf_scan_special(p + 1, end);
+	if (p == end)
+	  return 0;
+	if (*p == ']')
+	  break;
+	p++;			/* the escaped character */
+      }
+      break;
+    }
+    p++;
+  }
+  return 0;
+}
+
+
+/*
+ * Parse a piece into arena. Returns 0 on an error.
+ */
+
+static int
+parse_piece(SGFWork *work, SGFVariation *var, SGFArena *arena)
+{
+  SGFNode top;
+  size_t length = var->length;
+  int flags = 0;
+
+  if (var->piece == PIECE_SEQUENCE) {
+    length = work->vars[var->child].start - var->start;
+    flags = SGF_READ_SEQUENCE;
+  }
+
+  memset(&top, 0, sizeof(top));
+  if (!sgfParseVariations(&top, var->start, length, arena, flags,
+			  work->charset)
+      || top.child == NULL)
+    return 0;
+
+  var->first = var->last = top.child;
+  var->first->parent = NULL;
+  while (var->last->child)
+    var->last = var->last->child;
+  return 1;
+}
+
+
+static int
+compare_length(const void *a, const void *b)
+{
+  size_t la = (*(SGFVariation * const *) a)->length;
+  size_t lb = (*(SGFVariation * const *) b)->length;
+
+  return la < lb ? 1 : la > lb ? -1 : 0;
+}
+
+
+/*
+ * Worker thread: parse pieces until none is left.
+ */
+
+static void *
+worker(void *data)
+{
+  SGFWorker *self = data;
+  SGFWork *work = self->work;
+
+  for (;;) {
+    int k;
+
+    pthread_mutex_lock(&work->lock);
+    k = work->failed ? work->num_order : work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (k >= work->num_order)
+      break;
+
+    if (!parse_piece(work, work->order[k], &self->arena)) {
+      pthread_mutex_lock(&work->lock);
+      work->failed = 1;
+      pthread_mutex_unlock(&work->lock);
+    }
+  }
+  return NULL;
+}
+
+
+/*
+ * Parse the pieces in threads, this one included. The arenas of the
+ * other threads are merged into arena.
+ */
+
+static void
+run_workers(SGFWork *work, SGFArena *arena, int threads)
+{
+  SGFWorker *workers;
+  int started, k;
+
+  if (threads > work->num_order)
+    threads = work->num_order > 0 ? work->num_order : 1;
+  workers = xalloc(threads * sizeof(SGFWorker));
+  pthread_mutex_init(&work->lock, NULL);
+  for (started = 0; started < threads; started++) {
+    workers[started].work = work;
+    sgfArenaInit(&workers[started].arena);
+    if (started > 0
+	&& pthread_create(&workers[started].thread, NULL, worker,
+			  &workers[started]) != 0)
+      break;
+  }
+
+  workers[0].arena = *arena;
+  worker(&workers[0]);
+  *arena = workers[0].arena;
+  for (k = 1; k < started; k++) {
+    pthread_join(workers[k].thread, NULL);
+    sgfArenaMerge(arena, &workers[k].arena);
+  }
+  pthread_mutex_destroy(&work->lock);
+  free(workers);
+}
+
+
+/*
+ * Read the first game in buffer like readsgfbuffer(), with threads
+ * parsing its variations, or as many as there are processors if
+ * threads is 0. Nodes and properties are allocated from arena, which
+ * the caller frees also if NULL is returned. Small games, games
+ * without variations and text which is not well formed are read by
+ * this thread alone.
+ */
+
+SGFNode *
+sgf_read_parallel(char *buffer, size_t size, SGFArena *arena, int threads)
+{
+  SGFParser parser;
+  SGFWork work;
+  SGFGame *games;
+  SGFNode *root;
+  char *charset = NULL;
+  size_t grain;
+  int num_games, k;
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  memset(&work, 0, sizeof(work));
+  num_games = sgf_index_games(buffer, size, &games);
+  if (threads > 1 && num_games > 0
+      && !index_variations(&work, buffer + games[0].offset,
+			   buffer + games[0].offset + games[0].length))
+    work.num_vars = 0;
+  free(games);
+
+  /* which gametrees are parsed as pieces */
+  grain = work.num_vars
+    ? work.vars[0].length / (threads * SGF_PARALLEL_GRAIN) : 0;
+  for (k = 0; k < work.num_vars; k++) {
+    SGFVariation *var = &work.vars[k];
+
+    if (var->parent >= 0 && work.vars[var->parent].piece != PIECE_SEQUENCE)
+      var->piece = PIECE_NONE;
+    else if (var->child < 0 || var->length <= grain)
+      var->piece = PIECE_TREE;
+    else
+      var->piece = PIECE_SEQUENCE;
+  }
+
+  if (work.num_vars == 0 || work.vars[0].piece != PIECE_SEQUENCE) {
+    free(work.vars);
+    return readsgfbuffer(buffer, size, arena, 0);
+  }
+
+  /* the root sequence, which starts the game like a whole file */
+  sgfparser_init(&parser, buffer,
+		 work.vars[work.vars[0].child].start - buffer, arena, 0);
+  root = sgfparser_read(&parser);
+  if (root == NULL) {
+    fprintf(stderr, "Parse error: ");
+    fprintf(stderr, parser.error, parser.errorarg);
+    fprintf(stderr, " at position %ld\n", parser.errorpos);
+    free(work.vars);
+    return NULL;
+  }
+  work.vars[0].first = work.vars[0].last = root;
+  while (work.vars[0].last->child)
+    work.vars[0].last = work.vars[0].last->child;
+  sgfGetCharProperty(root, "CA", &charset);
+  work.charset = charset;
+
+  work.order = xalloc(work.num_vars * sizeof(SGFVariation *));
+  for (k = 1; k < work.num_vars; k++)
+    if (work.vars[k].piece != PIECE_NONE)
+      work.order[work.num_order++] = &work.vars[k];
+  qsort(work.order, work.num_order, sizeof(SGFVariation *), compare_length);
+  run_workers(&work, arena, threads);
+
+  /* the variations of a sequence follow its last node */
+  for (k = 0; k < work.num_vars && !work.failed; k++) {
+    SGFVariation *var = &work.vars[k];
+    SGFNode **link;
+    int c;
+
+    if (var->piece != PIECE_SEQUENCE)
+      continue;
+    link = &var->last->child;
+    for (c = var->child; c >= 0; c = work.vars[c].next) {
+      work.vars[c].first->parent = var->last;
+      *link = work.vars[c].first;
+      link = &work.vars[c].first->next;
+    }
+  }
+
+  free(work.order);
+  free(work.vars);
+  if (work.failed)
+    return NULL;
+
+  sgfRelinkTree(root);
+  return root;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
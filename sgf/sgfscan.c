@@ -0,0 +1,149 @@
+/* droceRoG - block scanning of SGF text
+ *
+ * The parser spends most of its time in property values, comments in
+ * particular, looking for the closing ']' and for escapes. These
+ * functions look at a block of bytes at a time: 16 with SSE2 on x86 and
+ * with NEON on ARM, one machine word in the portable version. Defining
+ * SGF_SCAN_SCALAR selects the plain byte loops instead, for comparison.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sgftree.h"
+
+#if !defined(SGF_SCAN_SCALAR)
+# if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define SGF_SCAN_SSE2
+# elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define SGF_SCAN_NEON
+# else
+#  define SGF_SCAN_WORD
+# endif
+#endif
+
+/* Whitespace as isspace() in the C locale. */
+#define IS_SPACE(c) ((c) == ' ' || ((unsigned char) ((c) - '\t') <= '\r' - '\t'))
+
+
+#ifdef SGF_SCAN_WORD
+
+typedef uintptr_t word_t;
+
+#define ONES  ((word_t) -1 / 0xff)
+#define HIGHS (ONES * 0x80)
+
+/* Nonzero if any byte of x is zero. */
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+#endif
+
+
+/*
+ * Return the position of the first ']' or '\\' in [p, end), or end.
+ */
+
+const char *
+sgf_scan_special(const char *p, const char *end)
+{
+#if defined(SGF_SCAN_SSE2)
+  const __m128i bracket = _mm_set1_epi8(']');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, bracket),
+					      _mm_cmpeq_epi8(v, backslash)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#elif defined(SGF_SCAN_NEON)
+  const uint8x16_t bracket = vdupq_n_u8(']');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+
+  while (end - p >= 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) p);
+    uint64x2_t m = vreinterpretq_u64_u8(vorrq_u8(vceqq_u8(v, bracket),
+						 vceqq_u8(v, backslash)));
+    if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1))
+      break;                    /* found in this block */
+    p += 16;
+  }
+#elif defined(SGF_SCAN_WORD)
+  while ((size_t) (end - p) >= sizeof(word_t)) {
+    word_t w;
+    memcpy(&w, p, sizeof(w));
+    if (HAS_ZERO(w ^ (ONES * ']')) || HAS_ZERO(w ^ (ONES * '\\')))
+      break;                    /* found in this word */
+    p += sizeof(word_t);
+  }
+#endif
+
+  while (p < end && *p != ']' && *p != '\\')
+    p++;
+  return p;
+}
+
+
+/*
+ * Return the position of the first non-whitespace byte in [p, end), or
+ * end. Most runs are short, so the first byte is looked at alone.
+ */
+
+const char *
+sgf_skip_space(const char *p, const char *end)
+{
+  if (p == end || !IS_SPACE(*p))
+    return p;
+
+#if defined(SGF_SCAN_SSE2)
+  {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+
+    while (end - p >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) p);
+      __m128i d = _mm_sub_epi8(v, tab);
+      __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+				_mm_cmpeq_epi8(_mm_min_epu8(d, range), d));
+      int mask = ~_mm_movemask_epi8(ws) & 0xffff;
+      if (mask)
+	return p + __builtin_ctz(mask);
+      p += 16;
+    }
+  }
+#elif defined(SGF_SCAN_NEON)
+  {
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t range = vdupq_n_u8('\r' - '\t');
+
+    while (end - p >= 16) {
+      uint8x16_t v = vld1q_u8((const uint8_t *) p);
+      uint8x16_t ws = vorrq_u8(vceqq_u8(v, space),
+			       vcleq_u8(vsubq_u8(v, tab), range));
+      uint64x2_t m = vreinterpretq_u64_u8(vmvnq_u8(ws));
+      if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1))
+	break;                  /* found in this block */
+      p += 16;
+    }
+  }
+#endif
+
+  while (p < end && IS_SPACE(*p))
+    p++;
+  return p;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
@@ -0,0 +1,189 @@
+/* droceRoG - memory accounting of game trees
+ *
+ * Counts what a tree is made of, the nodes, the properties by name and
+ * the bytes of their values, and the shape of the tree, and how much
+ * memory that takes. Files which need far more memory than others of
+ * the same size can be told apart this way: many small nodes, long
+ * comments, or a few properties with huge point lists.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sgftree.h"
+
+
+/*
+ * The entry of a property name in stats, the last one for all names
+ * which do not fit any more.
+ */
+
+static SGFPropStats *
+name_stats(SGFTreeStats *stats, short name)
+{
+  int k;
+
+  for (k = 0; k < stats->num_names; k++)
+    if (stats->names[k].name == name)
+      return &stats->names[k];
+
+  if (stats->num_names == SGF_STATS_MAX_NAMES) {
+    stats->names[k - 1].name = 0;
+    return &stats->names[k - 1];
+  }
+  stats->names[k].name = name;
+  stats->num_names++;
+  return &stats->names[k];
+}
+
+
+static void
+count_node(SGFTreeStats *stats, SGFNode *node, int depth)
+{
+  SGFProperty *prop;
+  SGFNode *child;
+  int children = 0;
+
+  stats->num_nodes++;
+  stats->node_bytes += sizeof(SGFNode);
+  if (depth > stats->max_depth)
+    stats->max_depth = depth;
+
+  for (child = node->child; child; child = child->next)
+    children++;
+  if (children > stats->max_branching)
+    stats->max_branching = children;
+  if (children > 1)
+    stats->num_variations += children - 1;
+
+  if (node->unparsed) {
+    stats->num_unparsed++;
+    stats->unparsed_bytes += node->unparsed->length;
+    stats->node_bytes += sizeof(SGFRange);
+  }
+
+  for (prop = node->props; prop; prop = prop->next) {
+    SGFPropStats *name = name_stats(stats, prop->name);
+    size_t length = prop->value ? strlen(prop->value) + 1 : 0;
+
+    stats->num_props++;
+    stats->prop_bytes += sizeof(SGFProperty);
+    name->count++;
+    name->value_bytes += length;
+    if (prop->flags & SGF_PROP_BORROWED)
+      stats->borrowed_bytes += length;
+    else
+      stats->value_bytes += length;
+  }
+}
+
+
+/*
+ * Count the nodes and properties of the tree below root, root included,
+ * into stats. Values marked SGF_PROP_BORROWED are counted apart, their
+ * memory belongs to the input buffer. Variations not parsed yet count
+ * with the length of their text only. The tree is walked without
+ * recursion, it may be as deep as the game is long.
+ */
+
+void
+sgfGetTreeStats(SGFNode *root, SGFTreeStats *stats)
+{
+  SGFNode *node = root;
+  int depth = 1;
+
+  memset(stats, 0, sizeof(*stats));
+  while (node) {
+    count_node(stats, node, depth);
+    if (node->child) {
+      node = node->child;
+      depth++;
+      continue;
+    }
+    while (node != root && node->next == NULL) {
+      node = node->parent;
+      depth--;
+    }
+    node = node == root ? NULL : node->next;
+  }
+}
+
+
+/*
+ * The same for an SGFTree, with the memory held by the tree itself: the
+ * blocks of its arena, its file buffer and its mapped cache.
+ */
+
+void
+sgftree_stats(SGFTree *tree, SGFTreeStats *stats)
+{
+  SGFArenaBlock *block;
+
+  if (tree->root)
+    sgfGetTreeStats(tree->root, stats);
+  else
+    memset(stats, 0, sizeof(*stats));
+
+  for (block = tree->arena.blocks; block; block = block->next)
+    stats->arena_bytes += block->size;
+  stats->buffer_bytes = tree->buffer_size + tree->cache_size;
+}
+
+
+static int
+compare_value_bytes(const void *a, const void *b)
+{
+  size_t la = ((const SGFPropStats *) a)->value_bytes;
+  size_t lb = ((const SGFPropStats *) b)->value_bytes;
+
+  return la < lb ? 1 : la > lb ? -1 : 0;
+}
+
+
+/*
+ * Print stats to file, the property names with the most value bytes
+ * first.
+ */
+
+void
+sgfPrintTreeStats(FILE *file, const SGFTreeStats *stats)
+{
+  SGFPropStats names[SGF_STATS_MAX_NAMES];
+  int k;
+
+  fprintf(file, "nodes         %10d  %10lu bytes\n", stats->num_nodes,
+	  (unsigned long) stats->node_bytes);
+  fprintf(file, "properties    %10d  %10lu bytes\n", stats->num_props,
+	  (unsigned long) stats->prop_bytes);
+  fprintf(file, "values                    %10lu bytes, %lu borrowed\n",
+	  (unsigned long) stats->value_bytes,
+	  (unsigned long) stats->borrowed_bytes);
+  fprintf(file, "unparsed      %10d  %10lu bytes of text\n",
+	  stats->num_unparsed, (unsigned long) stats->unparsed_bytes);
+  fprintf(file, "arena                     %10lu bytes\n",
+	  (unsigned long) stats->arena_bytes);
+  fprintf(file, "buffer                    %10lu bytes\n",
+	  (unsigned long) stats->buffer_bytes);
+  fprintf(file, "depth %d, branching %d, variations %d\n",
+	  stats->max_depth, stats->max_branching, stats->num_variations);
+
+  memcpy(names, stats->names, stats->num_names * sizeof(SGFPropStats));
+  qsort(names, stats->num_names, sizeof(SGFPropStats), compare_value_bytes);
+  for (k = 0; k < stats->num_names; k++) {
+    if (names[k].name == 0)
+      fprintf(file, "  other");
+    else
+      fprintf(file, "  %c%c   ", names[k].name & 0xff, names[k].name >> 8);
+    fprintf(file, " %10d  %10lu bytes\n", names[k].count,
+	    (unsigned long) names[k].value_bytes);
+  }
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
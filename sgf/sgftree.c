@@ -22,6 +22,8 @@
 \* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "sgftree.h"
 
@@ -30,25 +32,532 @@ sgftree_clear(SGFTree *tree)
 {
   tree->root = NULL;
   tree->lastnode = NULL;
+  sgfArenaInit(&tree->arena);
+  tree->buffer = NULL;
+  tree->buffer_size = 0;
+  tree->buffer_mapped = 0;
+  tree->game = 0;
+  tree->game_offset = 0;
+  tree->game_length = 0;
+  tree->cache = NULL;
+  tree->cache_size = 0;
+  tree->journal = NULL;
+  tree->edited = 0;
 }
 
+
+/*
+ * Free the nodes of the tree together with the file buffer (and cache)
+ * they point into, and clear it. A tree read from a file is released
+ * at once with its arena, only trees built on the heap need to be
+ * walked.
+ */
+
+void
+sgftree_free(SGFTree *tree)
+{
+  if (tree->arena.blocks)
+    sgfArenaFree(&tree->arena);
+  else
+    sgfFreeNode(tree->root);
+  sgf_unloadfile(tree->buffer, tree->buffer_size, tree->buffer_mapped);
+  sgf_unloadfile(tree->cache, tree->cache_size, 1);
+  free(tree->journal);
+  sgftree_clear(tree);
+}
+
+
+/*
+ * Parse the part of a loaded file buffer at offset into the tree. On
+ * success the tree takes over the buffer, otherwise it is released
+ * and the tree is left untouched.
+ */
+
+static int
+read_buffer(SGFTree *tree, char *buffer, size_t size, int mapped,
+	    size_t offset, size_t length, int flags)
+{
+  SGFNode *root;
+  SGFArena arena;
+
+  sgfArenaInit(&arena);
+  root = readsgfbuffer(buffer + offset, length, &arena, flags);
+  if (root == NULL) {
+    sgfArenaFree(&arena);
+    sgf_unloadfile(buffer, size, mapped);
+    return 0;
+  }
+  
+  sgftree_free(tree);
+  tree->root = root;
+  tree->arena = arena;
+  tree->buffer = buffer;
+  tree->buffer_size = size;
+  tree->buffer_mapped = mapped;
+  tree->game_offset = offset;
+  tree->game_length = length;
+  return 1;
+}
+
+
+/*
+ * Read game number game of a compressed file into the tree, see
+ * sgf_open_compressed(). The file is decompressed while it is parsed
+ * and not kept: the property values are copied into the arena of the
+ * tree.
+ */
+
+static int
+read_stream(SGFTree *tree, const char *infilename, int game)
+{
+  SGFStream stream;
+  SGFNode *root;
+  SGFArena arena;
+
+  if (!sgf_open_compressed(&stream, infilename))
+    return 0;
+
+  sgfArenaInit(&arena);
+  root = readsgfstream(&stream, &arena, game);
+  stream.close(stream.source);
+  if (root == NULL) {
+    sgfArenaFree(&arena);
+    return 0;
+  }
+
+  sgftree_free(tree);
+  tree->root = root;
+  tree->arena = arena;
+  tree->game = game;
+  return 1;
+}
+
+
+/*
+ * Read a tree from a file. The file is mapped and the property values
+ * are not copied, but point into the mapping owned by the tree. Nodes
+ * and properties are allocated from the arena of the tree.
+ */
+
 int
 sgftree_readfile(SGFTree *tree, const char *infilename)
 {
-  SGFNode *savetree = tree->root;
+  char *buffer;
+  size_t size;
+  int mapped;
 
-  tree->root = readsgffile(infilename);
-  if (tree->root == NULL) {
-    tree->root = savetree;
+  if (sgf_is_compressed(infilename))
+    return read_stream(tree, infilename, 0);
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+
+  return read_buffer(tree, buffer, size, mapped, 0, size, 0);
+}
+
+
+/*
+ * Read game number game (counting from 0) of a collection file into
+ * the tree. The file is only scanned for the boundaries of its games,
+ * and just the selected game is parsed. With SGF_READ_LAZY in flags,
+ * variations are parsed on demand by sgftreeExpandVariations(). A
+ * compressed file is parsed up to the selected game instead, and
+ * always read completely.
+ */
+
+int
+sgftree_readgame(SGFTree *tree, const char *infilename, int game,
+		 int flags)
+{
+  SGFGame *games;
+  int num_games;
+  char *buffer;
+  size_t size;
+  int mapped;
+  int result;
+
+  if (sgf_is_compressed(infilename))
+    return read_stream(tree, infilename, game);
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+
+  num_games = sgf_index_games(buffer, size, &games);
+  if (game < 0 || game >= num_games) {
+    free(games);
+    sgf_unloadfile(buffer, size, mapped);
     return 0;
   }
-  
-  sgfFreeNode(savetree);
-  tree->lastnode = NULL;
+
+  result = read_buffer(tree, buffer, size, mapped,
+		       games[game].offset, games[game].length, flags);
+  if (result)
+    tree->game = game;
+  free(games);
+  return result;
+}
+
+
+static int
+count_game(void *data)
+{
+  (*(int *) data)++;
+  return 0;
+}
+
+
+static const SGFHandler count_handler = {
+  count_game, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+
+/*
+ * Count the games in a compressed file. It has to be decompressed, and
+ * the root nodes are parsed, without building any nodes; a game with a
+ * parse error is the last one counted.
+ */
+
+static int
+count_stream(const char *infilename)
+{
+  SGFStream stream;
+  SGFParser parser;
+  int num_games = 0;
+
+  if (!sgf_open_compressed(&stream, infilename))
+    return 0;
+
+  sgfparser_init_stream(&parser, &stream, NULL, SGF_READ_ROOT);
+  sgfparser_stream(&parser, &count_handler, &num_games);
+  stream.close(stream.source);
+  return num_games;
+}
+
+
+/*
+ * Count the games in a collection file without parsing them. Returns
+ * 0 if the file will not open.
+ */
+
+int
+sgftree_countgames(const char *infilename)
+{
+  SGFGame *games;
+  int num_games;
+  char *buffer;
+  size_t size;
+  int mapped;
+
+  if (sgf_is_compressed(infilename))
+    return count_stream(infilename);
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+
+  num_games = sgf_index_games(buffer, size, &games);
+  free(games);
+  sgf_unloadfile(buffer, size, mapped);
+  return num_games;
+}
+
+
+/*
+ * Reading the game information: the properties of the root node of
+ * every game are collected in a growing array of SGFGameInfo. The
+ * parser reports nothing else with SGF_READ_ROOT, it skips the rest of
+ * every game. The parse stops at the root node of game last, so the
+ * rest of that game is not read.
+ */
+
+typedef struct SGFInfoReader_t {
+  SGFGameInfo *info;
+  int num_games;
+  int size;
+  int last;                     /* game to stop in, -1 for none   */
+  SGFArena *arena;              /* holds the texts                */
+} SGFInfoReader;
+
+
+static void
+clear_info(SGFGameInfo *info)
+{
+  memset(info, 0, sizeof(*info));
+  info->boardsize = 19;
+}
+
+
+static int
+info_game_begin(void *data)
+{
+  SGFInfoReader *reader = data;
+
+  if (reader->last >= 0 && reader->num_games > reader->last)
+    return 1;
+  if (reader->num_games == reader->size) {
+    reader->size = reader->size ? 2 * reader->size : 16;
+    reader->info = xrealloc(reader->info,
+			    reader->size * sizeof(SGFGameInfo));
+  }
+  clear_info(&reader->info[reader->num_games++]);
+  return 0;
+}
+
+
+static int
+info_game_end(void *data)
+{
+  SGFInfoReader *reader = data;
+
+  return reader->num_games - 1 == reader->last;
+}
+
+
+static int
+info_property(void *data, const char *name, char *value)
+{
+  SGFInfoReader *reader = data;
+  SGFGameInfo *info;
+  char **text = NULL;
+  short sgf_name;
+
+  /* only game-info properties and SZ are of interest, all of two letters */
+  if (name[1] == '\0' || name[2] != '\0')
+    return 0;
+  sgf_name = name[0] | name[1] << 8;
+  if (sgf_name != SGFSZ
+      && !(sgf_property_info(sgf_name)->flags & SGF_PROPERTY_GAME_INFO))
+    return 0;
+
+  info = &reader->info[reader->num_games - 1];
+
+  switch (sgf_name) {
+  case SGFPB:
+    text = &info->black_name;
+    break;
+  case SGFBR:
+    text = &info->black_rank;
+    break;
+  case SGFPW:
+    text = &info->white_name;
+    break;
+  case SGFWR:
+    text = &info->white_rank;
+    break;
+  case SGFKM:
+    text = &info->komi;
+    break;
+  case SGFDT:
+    text = &info->date;
+    break;
+  case SGFRE:
+    text = &info->result;
+    break;
+  case SGFOT:
+    text = &info->overtime;
+    break;
+  case SGFRU:
+    text = &info->ruleset;
+    break;
+  case SGFSZ:
+    info->boardsize = atoi(value);
+    break;
+  case SGFHA:
+    info->handicap = atoi(value);
+    break;
+  case SGFTM:
+    info->time = (float) atof(value);
+    break;
+  }
+
+  /* the first value counts, as for sgfGetCharProperty() */
+  if (text && *text == NULL)
+    *text = sgfArenaStrdup(reader->arena, value);
+  return 0;
+}
+
+
+static const SGFHandler info_handler = {
+  info_game_begin, info_game_end, NULL, info_property, NULL, NULL, NULL
+};
+
+
+/*
+ * Parse the root nodes of a buffer up to game last, or of all games if
+ * last is -1, for the game information.
+ */
+
+static void
+read_info_buffer(SGFInfoReader *reader, char *buffer, size_t size, int last)
+{
+  SGFParser parser;
+
+  reader->last = last;
+  sgfparser_init(&parser, buffer, size, reader->arena, SGF_READ_ROOT);
+  sgfparser_stream(&parser, &info_handler, reader);
+}
+
+
+/*
+ * Read the game information of a compressed file, up to game last or
+ * all of it. The file has to be decompressed up to there, but only the
+ * root nodes are parsed.
+ */
+
+static void
+read_info_stream(SGFInfoReader *reader, const char *infilename, int last)
+{
+  SGFStream stream;
+  SGFParser parser;
+
+  if (!sgf_open_compressed(&stream, infilename))
+    return;
+
+  reader->last = last;
+  sgfparser_init_stream(&parser, &stream, reader->arena, SGF_READ_ROOT);
+  sgfparser_stream(&parser, &info_handler, reader);
+  stream.close(stream.source);
+}
+
+
+/*
+ * Read the game information of game number game (counting from 0) of
+ * a file into info, with the texts allocated from arena. Only the
+ * root node of the game is parsed. For the first game of a file that
+ * is the beginning of the file, the others are found by scanning for
+ * the boundaries of the games. Returns 0 if there is no such game.
+ */
+
+int
+sgftree_readinfo(const char *infilename, int game, SGFGameInfo *info,
+		 SGFArena *arena)
+{
+  SGFInfoReader reader;
+  char *buffer;
+  size_t size;
+  int mapped;
+
+  memset(&reader, 0, sizeof(reader));
+  reader.arena = arena;
+
+  if (sgf_is_compressed(infilename))
+    read_info_stream(&reader, infilename, game);
+  else {
+    buffer = sgf_loadfile(infilename, &size, &mapped);
+    if (buffer == NULL)
+      return 0;
+
+    if (game == 0)
+      read_info_buffer(&reader, buffer, size, 0);
+    else {
+      SGFGame *games;
+      int num_games = sgf_index_games(buffer, size, &games);
+
+      /* game is then the only one parsed */
+      if (game > 0 && game < num_games) {
+	read_info_buffer(&reader, buffer + games[game].offset,
+			 games[game].length, 0);
+	game = 0;
+      }
+      free(games);
+    }
+    sgf_unloadfile(buffer, size, mapped);
+  }
+
+  if (game < 0 || game >= reader.num_games) {
+    free(reader.info);
+    return 0;
+  }
+  *info = reader.info[game];
+  free(reader.info);
   return 1;
 }
 
 
+/*
+ * Read the game information of every game of a file, as
+ * sgftree_readinfo() does, into an array returned in *info, which the
+ * caller frees. A game whose root node cannot be parsed keeps the
+ * defaults. A file of fewer than min_games games gets no array, *info
+ * is NULL; an uncompressed one is then only indexed, no root node is
+ * parsed. Returns the number of games, 0 if the file will not open.
+ */
+
+int
+sgftree_readinfos(const char *infilename, SGFGameInfo **info,
+		  SGFArena *arena, int min_games)
+{
+  SGFInfoReader reader;
+  SGFGame *games;
+  char *buffer;
+  size_t size;
+  int mapped;
+  int num_games, k;
+
+  memset(&reader, 0, sizeof(reader));
+  reader.arena = arena;
+  *info = NULL;
+
+  if (sgf_is_compressed(infilename)) {
+    /* the games are only known after decompressing all of them */
+    read_info_stream(&reader, infilename, -1);
+    if (reader.num_games < min_games)
+      free(reader.info);
+    else
+      *info = reader.info;
+    return reader.num_games;
+  }
+
+  buffer = sgf_loadfile(infilename, &size, &mapped);
+  if (buffer == NULL)
+    return 0;
+
+  num_games = sgf_index_games(buffer, size, &games);
+  /* every slice is parsed up to its root node only */
+  if (num_games >= min_games)
+    for (k = 0; k < num_games; k++) {
+      read_info_buffer(&reader, buffer + games[k].offset, games[k].length,
+		       k);
+      /* one entry for every game, also if it did not begin */
+      if (reader.num_games == k) {
+	reader.last = -1;
+	info_game_begin(&reader);
+      }
+    }
+  free(games);
+  sgf_unloadfile(buffer, size, mapped);
+
+  *info = reader.info;
+  return num_games;
+}
+
+
+/*
+ * Parse the variations of a node of a lazily read tree, see
+ * sgfExpandVariations().
+ */
+
+int
+sgftreeExpandVariations(SGFTree *tree, SGFNode *node)
+{
+  return sgfExpandVariations(node, &tree->arena);
+}
+
+
+/*
+ * The same without updating the variation links, see
+ * sgfParseUnparsed().
+ */
+
+int
+sgftreeParseUnparsed(SGFTree *tree, SGFNode *node)
+{
+  return sgfParseUnparsed(node, &tree->arena);
+}
+
+
 /* Go back one node in the tree. If lastnode is NULL, go to the last
  * node (the one in main variant which has no children).
  */
@@ -306,7 +815,7 @@ sgftreeWriteResult(SGFTree *tree, float score, int overwrite)
 {
   assert(tree->root);
 
-  sgfWriteResult(tree->root, score, overwrite);
+  sgfArenaWriteResult(tree->root, score, overwrite, &tree->arena);
 }
 
 
@@ -25,6 +25,8 @@
 #define _SGFTREE_H_
 
 #include <stdio.h>
+#include <setjmp.h>
+#include <iconv.h>
 
 #include "sgf_properties.h"
 
@@ -49,6 +51,29 @@
 
 void *xalloc(unsigned int);
 
+
+/*
+ * A bump allocator. Memory is handed out from large blocks and can
+ * only be released all at once, by freeing the arena.
+ */
+
+typedef struct SGFArenaBlock_t {
+  struct SGFArenaBlock_t *next;
+  unsigned int size;
+} SGFArenaBlock;
+
+typedef struct SGFArena_t {
+  SGFArenaBlock *blocks;        /* most recent block first        */
+  char *ptr;                    /* free space in the most recent  */
+  char *end;                    /* block                          */
+} SGFArena;
+
+void sgfArenaInit(SGFArena *arena);
+void *sgfArenaAlloc(SGFArena *arena, unsigned int size);
+char *sgfArenaStrdup(SGFArena *arena, const char *s);
+void sgfArenaFree(SGFArena *arena);
+void sgfArenaMerge(SGFArena *arena, SGFArena *other);
+
 /*
  * A property of an SGF node.  An SGF node is described by a linked
  * list of these.
@@ -57,9 +82,99 @@ void *xalloc(unsigned int);
 typedef struct SGFProperty_t {
   struct SGFProperty_t *next;
   short name;
+  short flags;                  /* SGF_PROP_* bits                */
+  union {
+    struct {
+      short x, y;               /* SGF_PROP_POINT, -1 if missing  */
+    } point;
+    struct {
+      signed char x1, y1, x2, y2; /* SGF_PROP_RECT, corners incl. */
+    } rect;
+    int number;                 /* SGF_PROP_NUMBER                */
+    float real;                 /* SGF_PROP_REAL                  */
+  } data;
   char *value;
 } SGFProperty;
 
+/* The value points into a buffer owned by someone else (e.g. the
+ * mapped file of an SGFTree) and must not be freed or resized.
+ */
+#define SGF_PROP_BORROWED 0x0001
+
+/* Type of the decoded value in data, set when the property is made or
+ * overwritten. The text in value stays the reference, e.g. for display
+ * and writing. Point coordinates are in the convention of get_moveX()
+ * and get_moveY(), not checked against the board size. Doubles are
+ * stored as numbers. A compressed point list like AB[aa:ss] is kept
+ * as one rectangle property instead of a property for every point.
+ */
+#define SGF_PROP_TYPE     0x000e
+#define SGF_PROP_TEXT     0x0000
+#define SGF_PROP_POINT    0x0002
+#define SGF_PROP_NUMBER   0x0004
+#define SGF_PROP_REAL     0x0006
+#define SGF_PROP_RECT     0x0008
+
+
+/*
+ * What the SGF specification says about a property, from tables
+ * generated from sgf_properties.def at build time, see
+ * sgf_properties.cmake. The identifiers of one or two uppercase letters
+ * have a slot in sgf_property_ids, which holds their index in
+ * sgf_property_table, 0 for properties not in the specification.
+ * sgf_property_info() finds the entry of a name with two lookups.
+ */
+
+typedef struct SGFPropertyInfo_t {
+  short name;                   /* SGFxx, 0 for unknown ones      */
+  unsigned char value;          /* SGF_VALUE_*                    */
+  unsigned short flags;         /* SGF_PROPERTY_*                 */
+  unsigned char node_flags;     /* SGF_NODE_* bits it sets        */
+} SGFPropertyInfo;
+
+/* Value types, of one value of a list. */
+#define SGF_VALUE_UNKNOWN     0
+#define SGF_VALUE_NONE        1
+#define SGF_VALUE_NUMBER      2
+#define SGF_VALUE_REAL        3
+#define SGF_VALUE_DOUBLE      4
+#define SGF_VALUE_COLOR       5
+#define SGF_VALUE_SIMPLETEXT  6
+#define SGF_VALUE_TEXT        7
+#define SGF_VALUE_POINT       8
+#define SGF_VALUE_MOVE        9
+#define SGF_VALUE_STONE      10
+#define SGF_VALUE_COMPOSED   11
+
+#define SGF_PROPERTY_LIST       0x0001  /* list of values           */
+#define SGF_PROPERTY_ELIST      0x0002  /* which may be empty       */
+#define SGF_PROPERTY_RANGE      0x0004  /* of points, compressible  */
+#define SGF_PROPERTY_SETUP      0x0008
+#define SGF_PROPERTY_MOVE       0x0010
+#define SGF_PROPERTY_ROOT       0x0020
+#define SGF_PROPERTY_GAME_INFO  0x0040
+#define SGF_PROPERTY_MARKUP     0x0080
+#define SGF_PROPERTY_ANNOTATION 0x0100  /* move annotation          */
+#define SGF_PROPERTY_INHERIT    0x0200
+
+#define SGF_PROPERTY_SLOTS (26 * 27)
+
+extern const unsigned char sgf_property_ids[SGF_PROPERTY_SLOTS];
+extern const SGFPropertyInfo sgf_property_table[];
+
+int sgf_property_id(short name);
+const SGFPropertyInfo *sgf_property_info(short name);
+
+
+/*
+ * A range of the input which is not parsed yet.
+ */
+
+typedef struct SGFRange_t {
+  char *start;
+  size_t length;
+} SGFRange;
+
     
 typedef struct SGFNode_t {
   SGFProperty *props;
@@ -70,14 +185,37 @@ typedef struct SGFNode_t {
   struct SGFNode_t *nextVar;    /* variation access.              */
   int draw_lvl;                 /* droceRoG: draw level           */
   int move_num;                 /* droceRoG: move number          */
+  int flags;                    /* SGF_NODE_* bits                */
+  SGFRange *unparsed;           /* lazy reading: variations after */
+                                /* the first child, not parsed yet */
 } SGFNode;
 
+/* What properties a node has, kept up to date when properties are made
+ * or overwritten, so that the tests in sgf_utils.c need not look at
+ * them. The colour and pass bits are for the first move of the node.
+ * [tt] is a pass only on boards up to 19x19, so it has a bit of its
+ * own, see is_pass_node().
+ */
+#define SGF_NODE_BLACK    0x0001  /* B                              */
+#define SGF_NODE_WHITE    0x0002  /* W                              */
+#define SGF_NODE_MOVE     (SGF_NODE_BLACK | SGF_NODE_WHITE)
+#define SGF_NODE_PASS     0x0004  /* B[] or W[]                     */
+#define SGF_NODE_COMMENT  0x0008  /* C                              */
+#define SGF_NODE_MARKUP   0x0010  /* CR SQ TR MA BM DO IT TE        */
+#define SGF_NODE_SETUP    0x0020  /* AB AW AE                       */
+#define SGF_NODE_LABEL    0x0040  /* LB                             */
+#define SGF_NODE_TT       0x0080  /* B[tt] or W[tt]                 */
+
 
 /* low level functions */
 SGFNode *sgfPrev(SGFNode *node);
 SGFNode *sgfRoot(SGFNode *node);
 SGFNode *sgfNewNode(void);
 void sgfFreeNode(SGFNode *node);
+int sgfExpandVariations(SGFNode *node, SGFArena *arena);
+int sgfParseUnparsed(SGFNode *node, SGFArena *arena);
+int sgfParseVariations(SGFNode *node, char *start, size_t length,
+		       SGFArena *arena, int flags, const char *charset);
 
 int sgfGetIntProperty(SGFNode *node, const char *name, int *value);
 int sgfGetFloatProperty(SGFNode *node, const char *name, float *value);
@@ -114,9 +252,158 @@ SGFNode *sgfBoardNumber(SGFNode *node, int i, int j, int number);
 SGFNode *sgfStartVariant(SGFNode *node);
 SGFNode *sgfStartVariantFirst(SGFNode *node);
 SGFNode *sgfAddChild(SGFNode *node);
+/* The same, allocating from arena unless it is NULL. */
+SGFProperty *sgfArenaAddProperty(SGFNode *node, const char *name,
+				 const char *value, SGFArena *arena);
+SGFNode *sgfArenaAddChild(SGFNode *node, SGFArena *arena);
+void sgfArenaAddComment(SGFNode *node, const char *text, SGFArena *arena);
+void sgfArenaOverwriteProperty(SGFNode *node, const char *name,
+			       const char *text, SGFArena *arena);
+void sgfArenaWriteResult(SGFNode *node, float score, int overwrite,
+			 SGFArena *arena);
+/* Update the variation links after nodes were added. */
+void sgfRelinkTree(SGFNode *root);
 
 SGFNode *sgfCreateHeaderNode(int boardsize, float komi, int handicap);
 
+/*
+ * Events of the streaming parser, see sgfparser_stream(). Every game
+ * is reported as game_begin, its nodes in file order, and game_end. A
+ * node is reported by node_begin and a property call for every value
+ * of its properties; name is the property identifier without lowercase
+ * letters, value is unescaped and NUL terminated in the input buffer,
+ * or for a stream in a buffer of the parser valid until the callback
+ * returns. Values of a game whose root declares another charset than
+ * UTF-8 with CA are converted to UTF-8, see sgfparser_set_charset().
+ * A nested gametree lies between variation_push and variation_pop. In
+ * lazy mode, the variations of a node after the first are reported by
+ * variations_skipped as a range of the input instead, to be parsed
+ * later with SGF_READ_VARIATIONS. Any callback may be NULL. A callback
+ * returning nonzero stops the parse.
+ */
+
+typedef struct SGFHandler_t {
+  int (*game_begin)(void *data);
+  int (*game_end)(void *data);
+  int (*node_begin)(void *data);
+  int (*property)(void *data, const char *name, char *value);
+  int (*variation_push)(void *data);
+  int (*variation_pop)(void *data);
+  int (*variations_skipped)(void *data, char *start, size_t length);
+} SGFHandler;
+
+/*
+ * Input read a chunk at a time instead of a complete buffer, e.g. a
+ * compressed file, see sgfparser_init_stream(). read() stores up to
+ * size bytes in buf and returns their number, 0 at the end of the
+ * input and -1 on an error. close() releases the source.
+ */
+
+typedef struct SGFStream_t {
+  int (*read)(void *source, char *buf, unsigned int size);
+  void (*close)(void *source);
+  void *source;
+} SGFStream;
+
+/*
+ * State of the SGF parser. Nothing is kept in global variables, so
+ * several files can be parsed at the same time, e.g. by different
+ * threads, each with its own SGFParser.
+ */
+
+typedef struct SGFParser_t {
+  char *buffer;                 /* the input, modified in place   */
+  char *ptr;                    /* current read position          */
+  char *end;                    /* end of the input               */
+  SGFStream *stream;            /* refills buffer, or NULL        */
+  long offset;                  /* stream position of buffer      */
+  char *value;                  /* values read from the stream    */
+  size_t valuesize;             /* allocated size of value        */
+  iconv_t charset;              /* to UTF-8, (iconv_t) -1 if none */
+  char *text;                   /* values converted to UTF-8      */
+  size_t textsize;              /* allocated size of text         */
+  SGFArena *arena;              /* tree allocation, NULL for heap */
+  int flags;                    /* SGF_READ_* options             */
+  int lookahead;                /* the next token                 */
+  const SGFHandler *handler;    /* receives the parsed events     */
+  void *data;                   /* argument of the callbacks      */
+  struct SGFParseFrame_t *stack; /* open gametrees, see gametree() */
+  int stackdepth;               /* number of open gametrees       */
+  int nodes;                    /* of the current game so far     */
+  int stacksize;                /* allocated size of the stack    */
+  const char *error;            /* parse error, NULL if none      */
+  int errorarg;                 /* argument of the error message  */
+  long errorpos;                /* offset of the error in input   */
+  jmp_buf abort;                /* parse errors return from here  */
+} SGFParser;
+
+/*
+ * Options for reading. SGF_READ_LAZY parses only the first child of
+ * every node and records the other variations as unparsed ranges,
+ * which sgfExpandVariations() parses on demand. The input buffer must
+ * then be kept as long as the tree, and nodes and properties must be
+ * allocated from an arena. SGF_READ_VARIATIONS makes
+ * sgfparser_stream() expect such a range, a list of gametrees, instead
+ * of complete games. With SGF_READ_SEQUENCE as well, the input may end
+ * behind the sequence of the first gametree, before its variations.
+ * SGF_READ_PARALLEL makes readsgfbuffer() parse the variations of a
+ * game in several threads, into an arena; it is ignored together with
+ * SGF_READ_LAZY. SGF_READ_ROOT makes sgfparser_stream() report only the
+ * root node of every game, followed by game_end, and skip the rest of
+ * it without parsing unless the handler stops the parse there.
+ */
+#define SGF_READ_LAZY       0x0001
+#define SGF_READ_VARIATIONS 0x0002
+#define SGF_READ_PARALLEL   0x0004
+#define SGF_READ_SEQUENCE   0x0008
+#define SGF_READ_ROOT       0x0010
+
+void sgfparser_init(SGFParser *parser, char *buffer, size_t size,
+		    SGFArena *arena, int flags);
+void sgfparser_init_stream(SGFParser *parser, SGFStream *stream,
+			   SGFArena *arena, int flags);
+SGFNode *sgfparser_read(SGFParser *parser);
+void sgfparser_set_charset(SGFParser *parser, const char *charset);
+int sgfparser_stream(SGFParser *parser, const SGFHandler *handler,
+		     void *data);
+
+/* Load a whole file into a writable buffer for parsing and release it. */
+char *sgf_loadfile(const char *filename, size_t *size, int *mapped);
+void sgf_unloadfile(char *buffer, size_t size, int mapped);
+
+/*
+ * Compressed files, read as a stream: gzip files and the entries of ZIP
+ * archives, named like "games.zip/game1.sgf".
+ */
+int sgf_is_compressed(const char *filename);
+int sgf_open_compressed(SGFStream *stream, const char *filename);
+/* List the files in a ZIP archive. */
+int sgf_zip_list(const char *zipname, char ***names);
+
+/* Find the next ']' or '\\', and skip whitespace, a block at a time. */
+const char *sgf_scan_special(const char *p, const char *end);
+const char *sgf_skip_space(const char *p, const char *end);
+
+/*
+ * Position of one game tree in a file holding a collection of games.
+ */
+
+typedef struct SGFGame_t {
+  size_t offset;                /* the opening '(' of the game    */
+  size_t length;                /* up to and including its ')'    */
+} SGFGame;
+
+/* Find the games in a buffer without parsing them. */
+int sgf_index_games(const char *buffer, size_t size, SGFGame **games);
+
+/* Read SGF tree from a buffer returned by sgf_loadfile(). */
+SGFNode *readsgfbuffer(char *buffer, size_t size, SGFArena *arena,
+			int flags);
+/* The same with threads parsing the variations, all CPUs if 0. */
+SGFNode *sgf_read_parallel(char *buffer, size_t size, SGFArena *arena,
+			   int threads);
+/* Read game number game of a stream. */
+SGFNode *readsgfstream(SGFStream *stream, SGFArena *arena, int game);
 /* Read SGF tree from file. */
 SGFNode *readsgffile(const char *filename);
 /* Specific solution for fuseki */
@@ -124,6 +411,7 @@ SGFNode *readsgffilefuseki(const char *filename, int moves_per_game);
 
 /* Write SGF tree to a file. */
 int writesgf(SGFNode *root, const char *filename);
+int fwritesgf(SGFNode *root, FILE *file);
 
 
 /* ---------------------------------------------------------------- */
@@ -131,14 +419,131 @@ int writesgf(SGFNode *root, const char *filename);
 /* ---------------------------------------------------------------- */
 
 
+/*
+ * The nodes and properties of a tree read with sgftree_readfile() are
+ * allocated from the arena of the tree, and its property values point
+ * into the file buffer. Both are released with sgftree_free(); never
+ * pass such nodes to sgfFreeNode(). Nodes added afterwards with the
+ * node level functions are allocated on the heap and are not
+ * released with the tree.
+ *
+ * A tree loaded from its cache file (see sgftree_readcache()) has its
+ * property values in the mapped cache instead, and one read from a
+ * compressed file has them in the arena, without a buffer.
+ *
+ * Annotations are saved in a journal next to the file instead of the
+ * file itself, see sgfjournal.c. A tree they were applied to is marked
+ * as edited and is not written to the cache.
+ */
+
 typedef struct SGFTree_t {
   SGFNode *root;
   SGFNode *lastnode;
+  SGFArena arena;               /* nodes and properties           */
+  char *buffer;                 /* file contents the property values */
+  size_t buffer_size;           /* of the tree point into            */
+  int buffer_mapped;
+  int game;                     /* number of the game in the file */
+  size_t game_offset;           /* and its position in buffer     */
+  size_t game_length;
+  char *cache;                  /* mapped cache file, or NULL     */
+  size_t cache_size;
+  char *journal;                /* annotation journal, or NULL    */
+  int edited;                   /* journal edits applied          */
 } SGFTree;
 
 
 void sgftree_clear(SGFTree *tree);
+void sgftree_free(SGFTree *tree);
 int sgftree_readfile(SGFTree *tree, const char *infilename);
+/* Read a single game of a collection, and count the games in a file. */
+int sgftree_readgame(SGFTree *tree, const char *infilename, int game,
+		     int flags);
+int sgftree_countgames(const char *infilename);
+
+/*
+ * The game information of a game, from its root node. Texts are NULL
+ * if the property is missing; the numbers are then 19 for the board
+ * size and 0 otherwise. TM is the time limit in seconds.
+ */
+
+typedef struct SGFGameInfo_t {
+  char *black_name;             /* PB                             */
+  char *black_rank;             /* BR                             */
+  char *white_name;             /* PW                             */
+  char *white_rank;             /* WR                             */
+  int boardsize;                /* SZ                             */
+  char *komi;                   /* KM                             */
+  int handicap;                 /* HA                             */
+  char *date;                   /* DT                             */
+  char *result;                 /* RE                             */
+  float time;                   /* TM                             */
+  char *overtime;               /* OT                             */
+  char *ruleset;                /* RU                             */
+} SGFGameInfo;
+
+/* Read only the root node of one game, or of every game of a file. */
+int sgftree_readinfo(const char *infilename, int game, SGFGameInfo *info,
+		     SGFArena *arena);
+int sgftree_readinfos(const char *infilename, SGFGameInfo **info,
+		      SGFArena *arena, int min_games);
+int sgftreeExpandVariations(SGFTree *tree, SGFNode *node);
+int sgftreeParseUnparsed(SGFTree *tree, SGFNode *node);
+
+/*
+ * Compiled tree cache: the parsed tree of a game, stored in a binary
+ * file next to the SGF file and mapped again on the next open.
+ */
+int sgftree_readcache(SGFTree *tree, const char *infilename, int game);
+int sgftree_writecache(SGFTree *tree, const char *infilename);
+
+/*
+ * Annotation journal: edits appended to a file next to the SGF file,
+ * replayed when the game is read and folded into it on export.
+ */
+int sgftree_readjournal(SGFTree *tree, const char *infilename);
+int sgftree_journal_comment(SGFTree *tree, SGFNode *node, const char *text);
+int sgftree_journal_marker(SGFTree *tree, SGFNode *node, const char *name,
+			   const char *value);
+SGFNode *sgftree_journal_variation(SGFTree *tree, SGFNode *node,
+				   const char *name, const char *value);
+int sgftree_export(SGFTree *tree, const char *infilename);
+
+/*
+ * What a tree is made of and the memory it takes, see sgfstats.c. The
+ * byte counts are of the structures and value strings themselves; the
+ * arena and buffer ones what the tree holds, which includes them.
+ */
+
+#define SGF_STATS_MAX_NAMES 96
+
+typedef struct SGFPropStats_t {
+  short name;                   /* 0 for all others               */
+  int count;
+  size_t value_bytes;
+} SGFPropStats;
+
+typedef struct SGFTreeStats_t {
+  int num_nodes;
+  int num_props;
+  int num_variations;           /* children after the first       */
+  int num_unparsed;             /* ranges of lazy reading         */
+  int max_depth;                /* nodes on the longest path      */
+  int max_branching;            /* most children of a node        */
+  size_t node_bytes;            /* SGFNodes and SGFRanges         */
+  size_t prop_bytes;            /* SGFProperties                  */
+  size_t value_bytes;           /* value strings, NULs included   */
+  size_t borrowed_bytes;        /* values in the input buffer     */
+  size_t unparsed_bytes;        /* text of unparsed variations    */
+  size_t arena_bytes;           /* blocks of the arena            */
+  size_t buffer_bytes;          /* file buffer and mapped cache   */
+  int num_names;
+  SGFPropStats names[SGF_STATS_MAX_NAMES];
+} SGFTreeStats;
+
+void sgfGetTreeStats(SGFNode *root, SGFTreeStats *stats);
+void sgftree_stats(SGFTree *tree, SGFTreeStats *stats);
+void sgfPrintTreeStats(FILE *file, const SGFTreeStats *stats);
 
 int sgftreeBack(SGFTree *tree);
 int sgftreeForward(SGFTree *tree);
@@ -179,6 +584,7 @@ int is_markup_node(SGFNode *node);
 int is_move_node(SGFNode *node);
 int is_pass_node(SGFNode *node, int boardsize);
 int find_move(SGFNode *node);
+int is_comment_node(SGFNode *node);
 
 
 #endif
@@ -12,7 +12,7 @@
 /* prototypes */
 int main_handler(int type, int par1, int par2);
 void msg(char *s);
-void cb_update_sgf(char *filename);
+void cb_update_sgf(char *filename, int game);
 
 /******************************************************************************/
 
@@ -25,6 +25,9 @@ static imenu menu1[] = {
   { ITEM_ACTIVE, 101, "Open SGF file...", NULL },
   { ITEM_ACTIVE, 102, "Go to move...", NULL },
   { ITEM_ACTIVE, 103, "Show help...", NULL },
+  { ITEM_ACTIVE, 106, "Memory usage...", NULL },
+  { ITEM_ACTIVE, 104, "Bookmark move", NULL },
+  { ITEM_ACTIVE, 105, "Export annotations", NULL },
   { 0, 0, NULL, NULL }
 
 };
@@ -39,6 +42,8 @@ void cb_page_selected(int page)
 
 void menu1_handler(int index)
 {
+    char text[512];
+
     switch (index) {
         case 101:
             fileselector_chooseFile(&cb_update_sgf);
@@ -50,6 +55,20 @@ void menu1_handler(int index)
             if (!gogame_set_showHelp(1))
                 gogame_draw_fullrepaint();
             break;
+        case 104:
+            if (!gogame_bookmark())
+                Message(ICON_WARNING, "Bookmark", "The bookmark could not be saved.", 2000);
+            break;
+        case 105:
+            if (gogame_export())
+                Message(ICON_INFORMATION, "Export", "The annotations were written to the SGF file.", 2000);
+            else
+                Message(ICON_WARNING, "Export", "The annotations could not be exported.", 2000);
+            break;
+        case 106:
+            if (gogame_memoryInfo(text, sizeof(text)))
+                Message(ICON_INFORMATION, "Memory usage", text, 10000);
+            break;
     }
 }
 
@@ -62,11 +81,11 @@ void msg(char *s)
   PartialUpdate(350, 770, 250, 20);
 }/*}}}*/
 
-void cb_update_sgf(char *filename)
+void cb_update_sgf(char *filename, int game)
 {/*{{{*/
     // fprintf(stderr, "drocerog.c: callback called: %s\n", filename);
 
-    gogame_new_from_file(filename);
+    gogame_new_from_collection(filename, game);
     gogame_draw_fullrepaint();
 }/*}}}*/
 
@@ -6,10 +6,14 @@
 #include "fileselector.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 
 #include <inkview.h>
+#include <sgftree.h>
 
 /******************************************************************************/
 
@@ -18,21 +22,42 @@ typedef struct TOC_Elem_s {
     tocentry toc;
     char full_fname[256];
     unsigned int isDir:1;
+    int numGames; /* games of a collection file, listed below it */
+    char *gameLabels; /* their names, owned by the GameList of the file */
 } TOC_Elem;
 
+/* The games of a file as read by tocElem_addGames. They are kept while the
+ * program runs, so that opening the file selector again only reads the
+ * files that changed since. */
+typedef struct GameList_s {
+    struct GameList_s *next;
+    char full_fname[256];
+    off_t size; /* -1 if not read yet */
+    time_t mtime;
+    int numGames;
+    char *gameLabels; /* numGames strings of GAME_LABEL_SIZE, or NULL */
+} GameList;
+
+#define GAME_LABEL_SIZE 96
+
 /******************************************************************************/
 
-void (*cb_update_fun)(char *filename) = NULL;
+void (*cb_update_fun)(char *filename, int game) = NULL;
 
 static TOC_Elem *lst;
 
 static tocentry *contents = NULL;
 
+static GameList *gameLists = NULL;
+
 /******************************************************************************/
 
 TOC_Elem *readFileList(char *dirname, int lvl);
+TOC_Elem *readArchiveList(char *zipname, int lvl);
 TOC_Elem *tocElem_new();
 void tocElem_free(TOC_Elem *elem);
+void tocElem_addGames(TOC_Elem *elem);
+void gameList_read(GameList *games);
 int tocElem_getNumInList(TOC_Elem *elem);
 
 /******************************************************************************/
@@ -40,16 +65,20 @@ int tocElem_getNumInList(TOC_Elem *elem);
 void entry_selected(int page) 
 {/*{{{*/
     TOC_Elem *cur;
+    int game;
 
     // fprintf(stderr, "fileselector.c: page %d selected.\n", page);
 
-    /* find selected entry */
+    /* find selected entry, games follow the page of their file */
     cur = lst;
-    while (cur && cur->toc.page != page)
+    while (cur && cur->next && cur->next->toc.page <= page)
         cur = cur->next;
-    assert(cur != NULL);
+    assert(cur != NULL && cur->toc.page <= page);
+    game = page - cur->toc.page - 1;
+    if (game < 0)
+        game = 0;
     if (cb_update_fun != NULL)
-        (*cb_update_fun)(cur->full_fname);
+        (*cb_update_fun)(cur->full_fname, game);
 
     /* free list */
     while (lst != NULL) {
@@ -65,26 +94,29 @@ void entry_selected(int page)
 
 }/*}}}*/
 
-void fileselector_chooseFile(void (*cb_update)(char *filename))
+void fileselector_chooseFile(void (*cb_update)(char *filename, int game))
 {/*{{{*/
     int current_page = 1;
     TOC_Elem *cur;
-    int i;
+    int i, j;
     int numElems;
+    int numEntries;
 
     cb_update_fun = cb_update;
 
     /* read directory */
     lst = readFileList(FLASHDIR, 0);
 
-    /* add increasing number to toc list */
+    /* add increasing number to toc list, games of a file get the numbers
+     * following it */
     i = 0;
     for (cur = lst; cur; cur = cur->next) {
         // fprintf(stderr, "list elem: %s [lvl: %d]\n", cur->full_fname, cur->toc.level);
         cur->toc.page = i;
         cur->toc.position = (long long) i;
-        i += 1;
+        i += 1 + cur->numGames;
     }
+    numEntries = i;
 
     numElems = tocElem_getNumInList(lst);
 
@@ -95,15 +127,22 @@ void fileselector_chooseFile(void (*cb_update)(char *filename))
     }
 
     /* build and populate contents list */
-    contents = (tocentry *) malloc(sizeof(tocentry) * (numElems - 1));
-    cur = lst->next;
-    for (i=0; i<numElems-1; i++) {
+    contents = (tocentry *) malloc(sizeof(tocentry) * (numEntries - 1));
+    i = 0;
+    for (cur = lst->next; cur; cur = cur->next) {
         contents[i].level = cur->toc.level;
         contents[i].page = cur->toc.page;
         contents[i].position = cur->toc.position;
         contents[i].text = cur->toc.text;
+        i += 1;
 
-        cur = cur->next;
+        for (j=0; j<cur->numGames; j++) {
+            contents[i].level = cur->toc.level + 1;
+            contents[i].page = cur->toc.page + 1 + j;
+            contents[i].position = (long long) contents[i].page;
+            contents[i].text = cur->gameLabels + j * GAME_LABEL_SIZE;
+            i += 1;
+        }
     }
 
     // for (i=0; i<numElems-1; i++) {
@@ -114,18 +153,41 @@ void fileselector_chooseFile(void (*cb_update)(char *filename))
     // fprintf(stderr, "ready building up content list\n");
     // fflush(stderr);
 
-    OpenContents(contents, numElems-1, current_page, (iv_tochandler) entry_selected);
+    OpenContents(contents, numEntries-1, current_page, (iv_tochandler) entry_selected);
 
     // fprintf(stderr, "finished OpenContents\n");
 }/*}}}*/
 
 int is_SGF_filename(char *fname)
 {/*{{{*/
+    size_t len;
+
     assert(fname);
 
+    /* skip the compiled tree caches and annotation journals stored next
+     * to the SGF files */
+    len = strlen(fname);
+    if (len >= 5 && (!strcmp(fname + len - 5, ".sgfc")
+                     || !strcmp(fname + len - 5, ".sgfj")))
+        return 0;
+
+    /* gzip compressed games are read as well, see sgf_is_compressed() */
+    if (len >= 7 && !strcmp(fname + len - 7, ".sgf.gz"))
+        return 1;
+
     return strstr(fname, ".sgf") > (char *)NULL;
 }/*}}}*/
 
+int is_ZIP_filename(char *fname)
+{/*{{{*/
+    size_t len;
+
+    assert(fname);
+
+    len = strlen(fname);
+    return len >= 4 && !strcasecmp(fname + len - 4, ".zip");
+}/*}}}*/
+
 char* get_filename_in_path(char *path)
 {/*{{{*/
     unsigned int i;
@@ -197,6 +259,17 @@ TOC_Elem *readFileList(char *dirname, int lvl)
             curElem->toc.level = lvl + 1;
             /* point only to filename */
             curElem->toc.text = get_filename_in_path(curElem->full_fname);
+
+            /* list the games of a collection */
+            tocElem_addGames(curElem);
+        }
+
+        /* list the SGF files in a ZIP archive like a subdirectory */
+        if (dir_content->d_type & DT_REG && is_ZIP_filename(dir_content->d_name)) {
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", dirname, dir_content->d_name);
+            curElem->next = readArchiveList(fullpath, lvl + 1);
+            while (curElem->next)   /* move to end of list */
+                curElem = curElem->next;
         }
             
 
@@ -210,6 +283,53 @@ TOC_Elem *readFileList(char *dirname, int lvl)
     return curList;
 }/*}}}*/
 
+/* The entries are found in the central directory of the archive, nothing is
+ * extracted. Their full names are the archive path followed by the name of
+ * the entry, which sgftree_readgame() reads straight from the archive. The
+ * games of collections inside an archive are not listed, counting them would
+ * mean inflating every entry. Returns NULL if there are no SGF files in the
+ * archive.
+ */
+TOC_Elem *readArchiveList(char *zipname, int lvl)
+{/*{{{*/
+    TOC_Elem *curElem, *curList;
+    char **names;
+    int numNames, i;
+
+    numNames = sgf_zip_list(zipname, &names);
+
+    /* add the archive to toc list */
+    curElem = tocElem_new();
+    snprintf(curElem->full_fname, sizeof(curElem->full_fname), "%s", zipname);
+    curElem->isDir = 1;
+    curElem->toc.level = lvl;
+    curElem->toc.text = get_filename_in_path(curElem->full_fname);
+    curList = curElem;
+
+    for (i=0; i<numNames; i++) {
+        if (!is_SGF_filename(names[i]))
+            continue;
+
+        curElem->next = tocElem_new();
+        curElem = curElem->next;
+        snprintf(curElem->full_fname, sizeof(curElem->full_fname),
+                 "%s/%s", zipname, names[i]);
+        curElem->isDir = 0;
+        curElem->toc.level = lvl + 1;
+        /* point only to filename */
+        curElem->toc.text = get_filename_in_path(curElem->full_fname);
+    }
+    free(names);
+
+    /* ignore archive without SGF files */
+    if (curElem == curList) {
+        tocElem_free(curList);
+        return NULL;
+    }
+
+    return curList;
+}/*}}}*/
+
 TOC_Elem *tocElem_new()
 {/*{{{*/
     TOC_Elem *elem;
@@ -222,6 +342,8 @@ TOC_Elem *tocElem_new()
     elem->toc.page = 0;
     elem->toc.position = 0;
     elem->toc.text = NULL;
+    elem->numGames = 0;
+    elem->gameLabels = NULL;
 
     return elem;
 }/*}}}*/
@@ -232,6 +354,78 @@ void tocElem_free(TOC_Elem *elem)
         free(elem);
 }/*}}}*/
 
+void tocElem_addGames(TOC_Elem *elem)
+{/*{{{*/
+    GameList *games;
+    struct stat st;
+
+    if (stat(elem->full_fname, &st) != 0)
+        return;
+
+    /* the games read before, if the file did not change */
+    for (games = gameLists; games; games = games->next)
+        if (!strcmp(games->full_fname, elem->full_fname))
+            break;
+    if (games && (games->size != st.st_size || games->mtime != st.st_mtime)) {
+        free(games->gameLabels);
+        games->gameLabels = NULL;
+        games->numGames = 0;
+        games->size = -1;
+    }
+    if (!games) {
+        games = (GameList *) calloc(1, sizeof(GameList));
+        if (games == NULL)
+            return;
+        snprintf(games->full_fname, sizeof(games->full_fname), "%s", elem->full_fname);
+        games->size = -1;
+        games->next = gameLists;
+        gameLists = games;
+    }
+    if (games->size == -1) {
+        gameList_read(games);
+        games->size = st.st_size;
+        games->mtime = st.st_mtime;
+    }
+
+    if (games->gameLabels != NULL) {
+        elem->numGames = games->numGames;
+        elem->gameLabels = games->gameLabels;
+    }
+}/*}}}*/
+
+/* Label the games of a collection file. Only the root node of each game is
+ * parsed, see sgftree_readinfos(). A file with a single game gets no labels,
+ * its root node is not read.
+ */
+void gameList_read(GameList *games)
+{/*{{{*/
+    SGFGameInfo *info;
+    SGFArena arena;
+    int numGames, i;
+
+    sgfArenaInit(&arena);
+    numGames = sgftree_readinfos(games->full_fname, &info, &arena, 2);
+    if (info != NULL)
+        games->gameLabels = (char *) malloc(numGames * GAME_LABEL_SIZE);
+    if (games->gameLabels != NULL) {
+        for (i=0; i<numGames; i++) {
+            char *label = games->gameLabels + i * GAME_LABEL_SIZE;
+
+            if (info[i].black_name || info[i].white_name)
+                snprintf(label, GAME_LABEL_SIZE, "Game %d: %s - %s%s%s", i + 1,
+                         info[i].black_name ? info[i].black_name : "?",
+                         info[i].white_name ? info[i].white_name : "?",
+                         info[i].result ? ", " : "",
+                         info[i].result ? info[i].result : "");
+            else
+                snprintf(label, GAME_LABEL_SIZE, "Game %d", i + 1);
+        }
+        games->numGames = numGames;
+    }
+    free(info);
+    sgfArenaFree(&arena);
+}/*}}}*/
+
 int tocElem_getNumInList(TOC_Elem *elem)
 {/*{{{*/
     int num = 0;
@@ -7,9 +7,11 @@
 #define FILESELECTOR_H
 
 /* Choose an SGF file by opening a selection tool and save the result by
- * calling "cb_update(filename)".
+ * calling "cb_update(filename, game)". Files holding a collection of games
+ * list their games below them, game is the number of the chosen one
+ * (counting from 0).
  */
-void fileselector_chooseFile(void (*cb_update)(char *filename));
+void fileselector_chooseFile(void (*cb_update)(char *filename, int game));
 
 #endif /* FILESELECTOR_H */
 
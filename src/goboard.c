@@ -320,6 +320,74 @@ void board_placeMarker(int r, int c, BoardMarker marker)
     }
 }/*}}}*/
 
+void board_placeStoneRect(int r1, int c1, int r2, int c2, BoardPlayer player)
+{/*{{{*/
+    GoBoardElement *field;
+    ListElem *last;
+    int r, c;
+
+    assert( curBoard != NULL );
+    assert( r1 >= 0 && r1 <= r2 && r2 < curBoard->size );
+    assert( c1 >= 0 && c1 <= c2 && c2 < curBoard->size );
+
+    /* look for the end of the history list once, not for every stone */
+    for (last = history_curNode->stones_placed; last && last->next; last = last->next)
+        ;
+
+    for (c = c1; c <= c2; c++) {
+        for (r = r1; r <= r2; r++) {
+            field = &curBoard->board[c * curBoard->size + r];
+            field->field_type = player == BOARD_BLACK ? FIELD_BLACK : FIELD_WHITE;
+            field->draw_update = 1;
+
+            last = list_newElem(last, r, c, field->field_type);
+            if (history_curNode->stones_placed == NULL)
+                history_curNode->stones_placed = last;
+        }
+    }
+}/*}}}*/
+
+void board_placeMarkerRect(int r1, int c1, int r2, int c2, BoardMarker marker)
+{/*{{{*/
+    GoBoardElement *field;
+    ListElem *last;
+    MarkerType type = MARKER_EMPTY;
+    int r, c;
+
+    assert( curBoard != NULL );
+    assert( r1 >= 0 && r1 <= r2 && r2 < curBoard->size );
+    assert( c1 >= 0 && c1 <= c2 && c2 < curBoard->size );
+
+    switch (marker) {
+        case MARK_SQUARE:
+            type = MARKER_SQUARE;
+            break;
+
+        case MARK_CIRC:
+            type = MARKER_CIRC;
+            break;
+
+        case MARK_TRIANGLE:
+            type = MARKER_TRIANGLE;
+            break;
+    }
+
+    for (last = history_curNode->marker_set; last && last->next; last = last->next)
+        ;
+
+    for (c = c1; c <= c2; c++) {
+        for (r = r1; r <= r2; r++) {
+            field = &curBoard->board[c * curBoard->size + r];
+            field->marker_type = type;
+            field->draw_update = 1;
+
+            last = list_newElem(last, r, c, type);
+            if (history_curNode->marker_set == NULL)
+                history_curNode->marker_set = last;
+        }
+    }
+}/*}}}*/
+
 int board_undo()
 {/*{{{*/
     HistoryElem *oldHist = NULL;
@@ -38,6 +38,12 @@ void board_placeStone(int r, int c, BoardPlayer player, int bIsMove);
  */
 void board_placeMarker(int r, int c, BoardMarker marker);
 
+/* Place stones (no move) or set markers on all positions (r,c) with
+ * r1 <= r <= r2 and c1 <= c <= c2 at once.
+ */
+void board_placeStoneRect(int r1, int c1, int r2, int c2, BoardPlayer player);
+void board_placeMarkerRect(int r1, int c1, int r2, int c2, BoardMarker marker);
+
 /* Undo current move. Returns 1 if successful, and 0 if not.
  */
 int board_undo();
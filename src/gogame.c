@@ -6,6 +6,7 @@
 #include "gogame.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <sgftree.h>
@@ -51,6 +52,8 @@ typedef struct {
 
 static SGFTree *gameTree = NULL; /* game tree */
 static SGFNode *curNode = NULL; /* current node in the game tree */
+static char *gameFilename = NULL; /* file the game was read from */
+static int bCacheDirty = 0; /* tree differs from its cache file */
 
 static char *comment_str = NULL;
 static int comment_update = 0;
@@ -79,7 +82,9 @@ void initDrawProperties();
 void test_readSGF();
 void debug_msg(char *s);
 void apply_sgf_cmds_to_board();
+void apply_sgf_rect_to_board(SGFProperty *prop, int sz);
 void updateCommentStr();
+void expandVariations(int numLevels);
 
 /******************************************************************************/
 
@@ -96,6 +101,11 @@ void debug_msg(char *s)
 }/*}}}*/
 
 int gogame_new_from_file(const char *filename)
+{/*{{{*/
+    return gogame_new_from_collection(filename, 0);
+}/*}}}*/
+
+int gogame_new_from_collection(const char *filename, int game)
 {/*{{{*/
     gogame_cleanup();
     initDrawProperties();
@@ -105,10 +115,20 @@ int gogame_new_from_file(const char *filename)
         return 1;
     sgftree_clear(gameTree); /* set node pointers to NULL */
 
-    if (!sgftree_readfile(gameTree, filename)) {
+    /* use the compiled tree of a game opened before, otherwise parse the
+     * file; variations are parsed when they are reached, see
+     * expandVariations */
+    if (sgftree_readcache(gameTree, filename, game)) {
+        bCacheDirty = 0;
+    } else if (sgftree_readgame(gameTree, filename, game, SGF_READ_LAZY)) {
+        bCacheDirty = 1;
+    } else {
         gogame_cleanup();
         return 2;
     }
+    gameFilename = strdup(filename);
+    /* annotations made before, see gogame_bookmark */
+    sgftree_readjournal(gameTree, filename);
     curNode = gameTree->root;
 
     readGameInfo();
@@ -128,9 +148,15 @@ int gogame_new_from_file(const char *filename)
 void gogame_cleanup()
 {/*{{{*/
     if (gameTree != NULL) {
+        /* store the parsed tree for the next time */
+        if (bCacheDirty && gameFilename != NULL)
+            sgftree_writecache(gameTree, gameFilename);
+        bCacheDirty = 0;
+        free(gameFilename);
+        gameFilename = NULL;
+
         /* free SGF info */
-        sgfFreeNode(gameTree->root); /* recursively free the sgf tree */
-        sgftree_clear(gameTree);
+        sgftree_free(gameTree); /* free the sgf tree and its file buffer */
         free(gameTree);
         gameTree = NULL;
         curNode = NULL;
@@ -233,13 +259,51 @@ void test_readSGF()
     }
 }/*}}}*/
 
+/* The game is read lazily: parse the variations branching off at the
+ * first numLevels levels of the variation window, starting with the
+ * level before the current move. All variations found in the window
+ * are parsed before the variation links are updated once; the new ones
+ * can have unparsed variations of their own, so the window is searched
+ * again until nothing is left to parse.
+ */
+void expandVariations(int numLevels)
+{/*{{{*/
+    SGFNode *nd = NULL;
+    SGFNode *ndVar = NULL;
+    SGFNode *ndBegin = NULL;
+    int i, bExpanded;
+
+    if (!gameTree || !curNode)
+        return;
+
+    do {
+        bExpanded = 0;
+
+        /* same levels as in draw_variation */
+        for (ndBegin=curNode; ndBegin->prevVar; ndBegin=ndBegin->prevVar) {};
+        if (ndBegin->parent)
+            ndBegin = ndBegin->parent;
+
+        /* new nodes are not linked yet, the walk sees only the old ones */
+        i = 0;
+        for (nd=ndBegin; nd && i < numLevels; nd=nd->child) {
+            for (ndVar=nd; ndVar; ndVar=ndVar->nextVar)
+                bExpanded |= sgftreeParseUnparsed(gameTree, ndVar);
+            i += 1;
+        }
+        if (bExpanded) {
+            sgfRelinkTree(gameTree->root);
+            bCacheDirty = 1;
+        }
+    } while (bExpanded);
+}/*}}}*/
+
 void draw_variation(int bPartialUpdate)
 {/*{{{*/
     int i, lvl, x, y, x_parent, y_parent;
     SGFNode *nd = NULL;
     SGFNode *ndVar = NULL;
     SGFNode *ndBegin = NULL;
-    char *tmp;
     char gInfo[256];
     int caps_b, caps_w;
 
@@ -266,6 +330,8 @@ void draw_variation(int bPartialUpdate)
                  drawProps.fontSize * 3,
                  gInfo, ALIGN_LEFT | VALIGN_TOP );
 
+    expandVariations(drawProps.varwin_w);
+
     /* find top variation */
     for (ndBegin=curNode; ndBegin->prevVar; ndBegin=ndBegin->prevVar) {};
 
@@ -298,16 +364,16 @@ void draw_variation(int bPartialUpdate)
                     SetFont(drawProps.varWin_ttf, BLACK);
 
                     /* draw stone */
-                    if (sgfGetCharProperty(ndVar, "B ", &tmp)) {
+                    if (find_move(ndVar) == STONE_BLACK) {
                         DrawString(x, y, "K");
                         SetFont(drawProps.varWin_ttf, WHITE);
-                    } else if (sgfGetCharProperty(ndVar, "W ", &tmp)) {
+                    } else {
                         DrawString(x, y, "L");
                         SetFont(drawProps.varWin_ttf, BLACK);
                     }
 
                     /* indicate comment if exists */
-                    if (sgfGetCharProperty(ndVar, "C ", &tmp))
+                    if (is_comment_node(ndVar))
                         DrawString(x, y, "O");
                 } else { /* no move: draw just a placeholder */
                     /* set position color */
@@ -542,8 +608,33 @@ void gogame_printGameInfo()
     fprintf(stderr, "            Ruleset = %s, Time = %d min, Overtime = %s\n", gameInfo.ruleset, gameInfo.time/60, gameInfo.overtime);
 }/*}}}*/
 
+int gogame_memoryInfo(char *text, int size)
+{/*{{{*/
+    SGFTreeStats stats;
+
+    if (gameTree == NULL)
+        return 0;
+
+    sgftree_stats(gameTree, &stats);
+
+    snprintf(text, size,
+             "Nodes: %d (%lu KB)\nProperties: %d (%lu KB)\nValues: %lu KB\n"
+             "Unparsed: %d variations (%lu KB)\nArena: %lu KB, buffer: %lu KB\n"
+             "Depth %d, branching %d, %d variations",
+             stats.num_nodes, (unsigned long) stats.node_bytes / 1024,
+             stats.num_props, (unsigned long) stats.prop_bytes / 1024,
+             (unsigned long) (stats.value_bytes + stats.borrowed_bytes) / 1024,
+             stats.num_unparsed, (unsigned long) stats.unparsed_bytes / 1024,
+             (unsigned long) stats.arena_bytes / 1024,
+             (unsigned long) stats.buffer_bytes / 1024,
+             stats.max_depth, stats.max_branching, stats.num_variations);
+    return 1;
+}/*}}}*/
+
 void readGameInfo()
 {/*{{{*/
+    float timeLimit = 0.0;
+
     assert(gameTree != NULL);
 
     GET_CHAR_PROP("PB", gameInfo.black.name);
@@ -560,7 +651,9 @@ void readGameInfo()
         gameInfo.handicap = 0;
     GET_CHAR_PROP("DT", gameInfo.date);
     GET_CHAR_PROP("RE", gameInfo.result);
-    if (!sgfGetIntProperty(gameTree->root, "TM", &gameInfo.time))
+    if (sgfGetFloatProperty(gameTree->root, "TM", &timeLimit))  /* a real */
+        gameInfo.time = (int) timeLimit;
+    else
         gameInfo.time = 0;
     GET_CHAR_PROP("OT", gameInfo.overtime);
     GET_CHAR_PROP("RU", gameInfo.ruleset);
@@ -576,6 +669,9 @@ void gogame_move_forward_update(int bUpdate)
     /* do nothing, if no continuation in this variation exists */
     if (!curNode->child) 
         return;
+    /* make the siblings of the next move known */
+    if (sgftreeExpandVariations(gameTree, curNode))
+        bCacheDirty = 1;
     curNode = curNode->child;
 
     apply_sgf_cmds_to_board();
@@ -588,10 +684,45 @@ void gogame_move_forward()
     gogame_move_forward_update(1);
 }/*}}}*/
 
+/* compressed point list, e.g. AB[aa:ss]: place it at once, clipped to the
+ * board */
+void apply_sgf_rect_to_board(SGFProperty *prop, int sz)
+{/*{{{*/
+    int x1 = prop->data.rect.x1, y1 = prop->data.rect.y1;
+    int x2 = prop->data.rect.x2, y2 = prop->data.rect.y2;
+
+    if (x1 >= sz || y1 >= sz)
+        return;
+    if (x2 >= sz)
+        x2 = sz - 1;
+    if (y2 >= sz)
+        y2 = sz - 1;
+
+    switch (prop->name) {
+        case ENC_SGFPROP('A', 'B'):
+            board_placeStoneRect(x1, y1, x2, y2, BOARD_BLACK);
+            break;
+        case ENC_SGFPROP('A', 'W'):
+            board_placeStoneRect(x1, y1, x2, y2, BOARD_WHITE);
+            break;
+
+        case ENC_SGFPROP('S', 'Q'):
+            board_placeMarkerRect(x1, y1, x2, y2, MARK_SQUARE);
+            break;
+        case ENC_SGFPROP('C', 'R'):
+            board_placeMarkerRect(x1, y1, x2, y2, MARK_CIRC);
+            break;
+        case ENC_SGFPROP('T', 'R'):
+            board_placeMarkerRect(x1, y1, x2, y2, MARK_TRIANGLE);
+            break;
+    }
+}/*}}}*/
+
 void apply_sgf_cmds_to_board()
 {/*{{{*/
     SGFProperty *prop = NULL;
     int sz = 0;
+    int x, y;
 
     assert(gameTree != NULL);
 
@@ -599,30 +730,40 @@ void apply_sgf_cmds_to_board()
 
     /* for all properties in this move */
     for (prop = curNode->props; prop; prop = prop->next) {
+        /* all handled properties are points, decoded by the parser */
+        if ((prop->flags & SGF_PROP_TYPE) == SGF_PROP_RECT) {
+            apply_sgf_rect_to_board(prop, sz);
+            continue;
+        }
+        if ((prop->flags & SGF_PROP_TYPE) != SGF_PROP_POINT)
+            continue;
+        x = prop->data.point.x < sz ? prop->data.point.x : -1;
+        y = prop->data.point.y < sz ? prop->data.point.y : -1;
+
         switch (prop->name) {
 
             case ENC_SGFPROP('A', 'B'):     /* added black stone */
-                board_placeStone(get_moveX(prop, sz), get_moveY(prop, sz), BOARD_BLACK, 0);
+                board_placeStone(x, y, BOARD_BLACK, 0);
                 break;
             case ENC_SGFPROP('A', 'W'):     /* added white stone */
-                board_placeStone(get_moveX(prop, sz), get_moveY(prop, sz), BOARD_WHITE, 0);
+                board_placeStone(x, y, BOARD_WHITE, 0);
                 break;
 
             case ENC_SGFPROP('B', ' '):     /* move: black stone */
-                board_placeStone(get_moveX(prop, sz), get_moveY(prop, sz), BOARD_BLACK, 1);
+                board_placeStone(x, y, BOARD_BLACK, 1);
                 break;
             case ENC_SGFPROP('W', ' '):     /* move: white stone */
-                board_placeStone(get_moveX(prop, sz), get_moveY(prop, sz), BOARD_WHITE, 1);
+                board_placeStone(x, y, BOARD_WHITE, 1);
                 break;
 
             case ENC_SGFPROP('S', 'Q'):     /* marker: square */
-                board_placeMarker(get_moveX(prop, sz), get_moveY(prop, sz), MARK_SQUARE);
+                board_placeMarker(x, y, MARK_SQUARE);
                 break;
             case ENC_SGFPROP('C', 'R'):     /* marker: circle */
-                board_placeMarker(get_moveX(prop, sz), get_moveY(prop, sz), MARK_CIRC);
+                board_placeMarker(x, y, MARK_CIRC);
                 break;
             case ENC_SGFPROP('T', 'R'):     /* marker: triangle */
-                board_placeMarker(get_moveX(prop, sz), get_moveY(prop, sz), MARK_TRIANGLE);
+                board_placeMarker(x, y, MARK_TRIANGLE);
                 break;
         }
     }
@@ -704,6 +845,9 @@ void gogame_moveVar_down()
     if (bShowFullScreenComment) /* disable motion while fullscreen comment */
         return;
 
+    /* parse variations branching off before the current move */
+    expandVariations(1);
+
     /* go to beginning of variations */
     ndCur = curNode;
     while (ndCur->prevVar)
@@ -737,6 +881,9 @@ void gogame_moveVar_up()
     if (bShowFullScreenComment) /* disable motion while fullscreen comment */
         return;
 
+    /* parse variations branching off before the current move */
+    expandVariations(1);
+
     /* go to beginning of variations */
     ndCur = curNode;
     while (ndCur->prevVar)
@@ -761,8 +908,6 @@ void gogame_moveVar_up()
 
 void gogame_move_to_nextEvt()
 {/*{{{*/
-    char *msg;
-
     if (gameTree == NULL)
         return;
     if (bShowFullScreenComment) /* disable motion while fullscreen comment */
@@ -772,7 +917,7 @@ void gogame_move_to_nextEvt()
     gogame_move_forward_update(0);
 
     /* move forward until end, variation, or comment is reached */
-    while (curNode->child && curNode->next == NULL && !sgfGetCharProperty(curNode, "C ", &msg)) {
+    while (curNode->child && curNode->next == NULL && !is_comment_node(curNode)) {
         gogame_move_forward_update(0);
     }
 
@@ -782,8 +927,6 @@ void gogame_move_to_nextEvt()
 
 void gogame_move_to_prevEvt()
 {/*{{{*/
-    char *msg;
-
     if (gameTree == NULL)
         return;
     if (bShowFullScreenComment) /* disable motion while fullscreen comment */
@@ -793,7 +936,7 @@ void gogame_move_to_prevEvt()
     gogame_move_back_update(0);
 
     /* move backward until beginning, variation, or comment is reached */
-    while (curNode->parent && curNode->next == NULL && curNode->parent->child->next == NULL && !sgfGetCharProperty(curNode, "C ", &msg)) {
+    while (curNode->parent && curNode->next == NULL && curNode->parent->child->next == NULL && !is_comment_node(curNode)) {
         gogame_move_back_update(0);
     }
 
@@ -843,6 +986,23 @@ int gogame_switch_fullComment()
     return 1;
 }/*}}}*/
 
+int gogame_bookmark()
+{/*{{{*/
+    if (gameTree == NULL)
+        return 0;
+
+    /* HO: hotspot, the node is of interest */
+    return sgftree_journal_marker(gameTree, curNode, "HO", "1");
+}/*}}}*/
+
+int gogame_export()
+{/*{{{*/
+    if (gameTree == NULL || gameFilename == NULL)
+        return 0;
+
+    return sgftree_export(gameTree, gameFilename);
+}/*}}}*/
+
 int gogame_isGameOpened()
 {/*{{{*/
     if (gameTree == NULL)
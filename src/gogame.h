@@ -12,6 +12,8 @@ extern "C"
 #endif
 
 int gogame_new_from_file(const char *filename);
+/* load game number game (counting from 0) of a collection file */
+int gogame_new_from_collection(const char *filename, int game);
 
 void gogame_cleanup();
 
@@ -48,6 +50,22 @@ int gogame_set_showHelp(int bShowHelp);
 /* Returns current status, see gogame_set_showHelp */
 int gogame_isHelpShown();
 
+/* Mark the current move. The mark is saved in the annotation journal
+ * next to the SGF file, not in the file itself.
+ * Returns 1 on success, otherwise 0
+ */
+int gogame_bookmark();
+/* Write the annotations of the journal into the SGF file.
+ * Returns 1 on success, otherwise 0
+ */
+int gogame_export();
+
+/* Describe the memory taken by the tree of the game in text, for
+ * debugging.
+ * Returns 1 on success, 0 if no game is loaded
+ */
+int gogame_memoryInfo(char *text, int size);
+
 /* check if a game has been loaded */
 int gogame_isGameOpened();
 